@@ -1,3 +1,6 @@
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600   // waitable timers with CreateWaitableTimerExW
+#endif
 #include <windows.h>
 #include <conio.h>
 #include <stdio.h>
@@ -356,13 +359,67 @@ void place_block(vect p, char*** blocks, char b) {
     }
 }
 
+// frame pacing: sleep on a high resolution waitable timer until just before each frame is
+// due, leaving as much time as frames have been taking, then read input and render
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#define TARGET_FPS 50
+
+typedef struct FramePacer {
+    LONGLONG freq, period, deadline, work, woke;   // in performance counter ticks
+    HANDLE timer;
+} frame_pacer;
+
+LONGLONG counter_now() {
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+void pacer_init(frame_pacer* p) {
+    LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    p->freq = f.QuadPart;
+    p->period = p->freq / TARGET_FPS;
+    p->work = 0;
+    p->deadline = counter_now() + p->period;
+    // older Windows lacks high resolution timers, a plain one still beats spinning
+    p->timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!p->timer) p->timer = CreateWaitableTimerW(NULL, TRUE, NULL);
+    if (!p->timer) { fprintf(stderr, "Failed to create frame timer\n"); exit(EXIT_FAILURE); }
+}
+
+void pacer_wait(frame_pacer* p) {
+    LONGLONG wake = p->deadline - p->work - p->freq / 1000;
+    LONGLONG now = counter_now();
+    if (wake > now) {
+        LARGE_INTEGER due;
+        due.QuadPart = -(wake - now) * 10000000 / p->freq;   // relative, in 100 ns units
+        SetWaitableTimer(p->timer, &due, 0, NULL, NULL, FALSE);
+        WaitForSingleObject(p->timer, INFINITE);
+    }
+    p->woke = counter_now();
+}
+
+void pacer_frame_done(frame_pacer* p) {
+    LONGLONG now = counter_now(), work = now - p->woke;
+    if (work > p->work) p->work = work;              // grow at once, shrink slowly
+    else p->work += (work - p->work) / 16;
+    p->deadline += p->period;
+    if (p->deadline < now + p->work) p->deadline = now + p->work;
+}
+
 int main() {
     init_terminal();
     char** picture = init_picture();
     char*** blocks = init_blocks();
     for (int x = 0;x < X_BLOCKS;x++) for (int y = 0;y < Y_BLOCKS;y++) for (int z = 0;z < 4;z++) blocks[z][y][x] = '@';
     player_pos_view pv = init_posview();
+    frame_pacer pacer;
+    pacer_init(&pacer);
     while (1) {
+        pacer_wait(&pacer);
         process_input();
         if (is_key_pressed('q')) break;
         update_pos_view(&pv, blocks);
@@ -379,8 +436,10 @@ int main() {
         get_picture(picture, pv, blocks);
         if (have && !removed) blocks[cz][cy][cx] = oldc;
         draw_ascii(picture);
-        Sleep(0);
+        fflush(stdout);
+        pacer_frame_done(&pacer);
     }
+    CloseHandle(pacer.timer);
     for (int i = 0; i < Y_PIXELS; i++) free(picture[i]); free(picture);
     for (int z = 0; z < Z_BLOCKS; z++) { for (int y = 0; y < Y_BLOCKS; y++) free(blocks[z][y]); free(blocks[z]); }
     free(blocks);
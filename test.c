@@ -5,18 +5,43 @@
 #include <termios.h>
 #include <stdlib.h>
 #include <math.h>
-#define Y_PIXELS 180
-#define X_PIXELS 900
-#define Z_BLOCKS 10
-#define Y_BLOCKS 20
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #define EYE_HEIGHT 1.5
-#define X_BLOCKS 20
 #define VIEW_HEIGHT 0.7
 #define VIEW_WIDTH 1
 #define BLOCK_BORDER_SIZE 0.05
 
+// frame and world sizes, picked at startup by init_dimensions
+typedef struct Dimensions {
+    int x_pixels;
+    int y_pixels;
+    int x_blocks;
+    int y_blocks;
+    int z_blocks;
+    int fixed_frame;          // the config sets the frame size, it doesn't follow the terminal
+} dimensions;
+
+static dimensions dims = { 900, 180, 20, 20, 10, 0 };
+
+#define X_PIXELS (dims.x_pixels)
+#define Y_PIXELS (dims.y_pixels)
+#define X_BLOCKS (dims.x_blocks)
+#define Y_BLOCKS (dims.y_blocks)
+#define Z_BLOCKS (dims.z_blocks)
+
 static struct termios old_termios, new_termios;
 
+// set by SIGWINCH, the game loop picks up the new terminal size
+static volatile sig_atomic_t terminal_resized = 0;
+
 // vect represents a 3D vector in cartesian coordinate system
 typedef struct Vector {
     float x;
@@ -37,6 +62,62 @@ typedef struct Vector_vector2 {
 } player_pos_view;
 
 
+int64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+    input is read by a thread of its own, so every key gets stamped with the moment it
+    arrived even while the game loop is asleep or busy rendering. process_input then takes
+    whatever came in since the last frame.
+*/
+typedef struct InputQueue {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    atomic_int running;
+    unsigned char keys[256];      // keys that arrived since the last process_input
+    int count;
+    int64_t first_ns;             // arrival of the oldest of them
+} input_queue;
+
+static input_queue input = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+void* input_thread(void* arg) {
+    (void)arg;
+    struct pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+    while (atomic_load(&input.running)) {
+        // wake up now and then to notice when the game is shutting down
+        if (poll(&fd, 1, 50) <= 0) continue;
+        unsigned char buffer[64];
+        ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+        if (n <= 0) continue;
+        int64_t now = now_ns();
+        pthread_mutex_lock(&input.lock);
+        if (input.count == 0) input.first_ns = now;
+        for (ssize_t i = 0; i < n && input.count < (int)sizeof(input.keys); i++) {
+            input.keys[input.count++] = buffer[i];
+        }
+        pthread_mutex_unlock(&input.lock);
+    }
+    return NULL;
+}
+
+void start_input() {
+    atomic_store(&input.running, 1);
+    if (pthread_create(&input.thread, NULL, input_thread, NULL) != 0) {
+        perror("Failed to start input thread");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void stop_input() {
+    if (!atomic_load(&input.running)) return;
+    atomic_store(&input.running, 0);
+    pthread_join(input.thread, NULL);
+}
+
 void init_terminal() {
     //to store the old terminal settings and store them in old_termios
     tcgetattr(STDIN_FILENO, &old_termios);
@@ -60,32 +141,93 @@ void init_terminal() {
 
     //rnsures that all output gets flushed ti the terminal screen for consistent behaviour
     fflush(stdout);
+
+    start_input();
 }
 
 void restore_terminal() {
+    stop_input();
     //restores the old terminal settings stored in the old_termios variable
     tcsetattr(STDIN_FILENO, TCSANOW, &old_termios);
     printf("terminal restored");
 }
 
+void on_sigwinch(int sig) {
+    (void)sig;
+    terminal_resized = 1;
+}
+
+//read the terminal size into the frame size, returns 0 if stdout isn't a terminal
+int read_terminal_size(int* width, int* height) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0 || ws.ws_col == 0 || ws.ws_row < 2) {
+        return 0;
+    }
+    *width = ws.ws_col;
+    *height = ws.ws_row - 1;   // keep the last line free so the frame doesn't scroll
+    return 1;
+}
+
+int clamp_int(int v, int lo, int hi) {
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+/*
+    pick the frame and world sizes. the defaults can be overridden in a config file of
+    "key = value" lines (width, height, world_x, world_y, world_z). the frame follows the
+    terminal unless the config fixes width and height.
+*/
+void init_dimensions(const char* config_path) {
+    int fixed_frame = 0;      // bit 0 width, bit 1 height
+    FILE* config = fopen(config_path, "r");
+    if (config != NULL) {
+        char line[256];
+        while (fgets(line, sizeof(line), config) != NULL) {
+            char key[64];
+            int value;
+            if (line[0] == '#' || sscanf(line, " %63[a-z_] = %d", key, &value) != 2) continue;
+            if (strcmp(key, "width") == 0) dims.x_pixels = value, fixed_frame |= 1;
+            else if (strcmp(key, "height") == 0) dims.y_pixels = value, fixed_frame |= 2;
+            else if (strcmp(key, "world_x") == 0) dims.x_blocks = value;
+            else if (strcmp(key, "world_y") == 0) dims.y_blocks = value;
+            else if (strcmp(key, "world_z") == 0) dims.z_blocks = value;
+        }
+        fclose(config);
+    }
+    dims.fixed_frame = fixed_frame == 3;
+    if (!dims.fixed_frame) {
+        read_terminal_size(&dims.x_pixels, &dims.y_pixels);
+    }
+    dims.x_pixels = clamp_int(dims.x_pixels, 2, 4096);
+    dims.y_pixels = clamp_int(dims.y_pixels, 2, 4096);
+    // the player starts at (5, 5) standing on ground 4 blocks high
+    dims.x_blocks = clamp_int(dims.x_blocks, 8, 4096);
+    dims.y_blocks = clamp_int(dims.y_blocks, 8, 4096);
+    dims.z_blocks = clamp_int(dims.z_blocks, 8, 1024);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigwinch;
+    sigaction(SIGWINCH, &sa, NULL);
+}
+
 //to cover all possible ASCII values
 static char keystate[256] = { 0 };
+static int64_t input_arrival_ns = 0;   // when the oldest key of this frame arrived, 0 if none
 
 void process_input() {
-    char c;
     for (int i = 0; i < 256; i++) {
         keystate[i] = 0;
     }
 
-    //reading input from the terminal byte by byte and stores it in the variable c
-    while (read(STDIN_FILENO, &c, 1) > 0) {
-        // printf("\ninput: %c", c);
-        //get the ASCII for the input character
-        unsigned char uc = (unsigned char)c;
-
-        //kinda making a visited array to register a key with this ASCII 'uc' begin pressed
-        keystate[uc] = 1;
+    pthread_mutex_lock(&input.lock);
+    for (int i = 0; i < input.count; i++) {
+        //kinda making a visited array to register a key with this ASCII value begin pressed
+        keystate[input.keys[i]] = 1;
     }
+    input_arrival_ns = input.count > 0 ? input.first_ns : 0;
+    input.count = 0;
+    pthread_mutex_unlock(&input.lock);
 }
 
 //check if the key is pressed
@@ -93,51 +235,75 @@ int is_key_pressed(char key) {
     return keystate[(unsigned char)key];
 }
 
-//initialise a image in the program by creating a image buffer
-//make an array of size Y_PIXELS, each storing an array of characters of size X_PIXELS
-char** init_picture() {
-    char** picture = malloc(sizeof(char*) * Y_PIXELS);
+/*
+    the picture the renderer draws into. every pixel has a glyph and colour for the terminal,
+    the distance to the surface it shows and the block it shows, so overlays can be drawn
+    against the scene afterwards without touching the world. the channels sit one after the
+    other in a single allocation, pixel (x, y) is entry y * width + x of each of them.
+*/
+#define FRAME_FAR INFINITY    // depth of pixels that show no block
+#define FRAME_NO_CELL -1      // cell of pixels that show no block
+
+typedef struct Framebuffer {
+    int width, height;
+    float* depth;             // distance along the pixel's ray to the surface it shows
+    int32_t* cell;            // (z * Y_BLOCKS + y) * X_BLOCKS + x of the block it shows
+    char* glyph;
+    uint8_t* colour;          // ANSI colour, 0 for the terminal's default
+} framebuffer;
+
+//initialise a image in the program by creating a image buffer of X_PIXELS by Y_PIXELS
+framebuffer* init_picture() {
+    size_t n = (size_t)X_PIXELS * Y_PIXELS;
+    framebuffer* picture = malloc(sizeof(framebuffer) + n * (sizeof(float) + sizeof(int32_t) + 2));
     if (picture == NULL) {
         perror("Failed to allocate picture");
         exit(EXIT_FAILURE);
     }
-    for (int i = 0; i < Y_PIXELS; i++) {
-        picture[i] = malloc(sizeof(char) * X_PIXELS);
-        if (picture[i] == NULL) {
-            perror("Failed to allocate picture row");
-            exit(EXIT_FAILURE);
-        }
-    }
+    picture->width = X_PIXELS;
+    picture->height = Y_PIXELS;
+    picture->depth = (float*)(picture + 1);
+    picture->cell = (int32_t*)(picture->depth + n);
+    picture->glyph = (char*)(picture->cell + n);
+    picture->colour = (uint8_t*)(picture->glyph + n);
     return picture;
 }
 
 //make/initialise a grid based block for the game
+//the cells live in one contiguous slab so whole rows and planes can be filled with memset
 char*** init_blocks() {
     char*** blocks = malloc(sizeof(char**) * Z_BLOCKS);
     if (blocks == NULL) {
         perror("Failed to allocate blocks");
         exit(EXIT_FAILURE);
     }
+    char** rows = malloc(sizeof(char*) * Z_BLOCKS * Y_BLOCKS);
+    if (rows == NULL) {
+        perror("Failed to allocate blocks layer");
+        exit(EXIT_FAILURE);
+    }
+    char* cells = malloc(sizeof(char) * Z_BLOCKS * Y_BLOCKS * X_BLOCKS);
+    if (cells == NULL) {
+        perror("Failed to allocate blocks row");
+        exit(EXIT_FAILURE);
+    }
+    memset(cells, ' ', (size_t)Z_BLOCKS * Y_BLOCKS * X_BLOCKS);
     for (int i = 0; i < Z_BLOCKS; i++) {
-        blocks[i] = malloc(sizeof(char*) * Y_BLOCKS);
-        if (blocks[i] == NULL) {
-            perror("Failed to allocate blocks layer");
-            exit(EXIT_FAILURE);
-        }
+        blocks[i] = rows + (size_t)i * Y_BLOCKS;
         for (int j = 0; j < Y_BLOCKS; j++) {
-            blocks[i][j] = malloc(sizeof(char) * X_BLOCKS);
-            if (blocks[i][j] == NULL) {
-                perror("Failed to allocate blocks row");
-                exit(EXIT_FAILURE);
-            }
-            for (int k = 0; k < X_BLOCKS; k++) {
-                blocks[i][j][k] = ' ';
-            }
+            blocks[i][j] = cells + ((size_t)i * Y_BLOCKS + j) * X_BLOCKS;
         }
     }
     return blocks;
 }
 
+//free a block grid made by init_blocks
+void free_blocks(char*** blocks) {
+    free(blocks[0][0]);
+    free(blocks[0]);
+    free(blocks);
+}
+
 // initializes and returns the starting position and viewing angles of the player in the game
 player_pos_view init_posview() {
     player_pos_view posview;
@@ -189,9 +355,9 @@ void vect_normalize(vect* v) {
     }
 }
 
-//initializes a 2D array of direction vectors for each pixel on a screen, based on a given camera/view orientation (vect2 view)
-//chatgpt'ed this logic cus it was taking too long
-vect** init_directions(vect2 view) {
+//the screen spanned around the view direction: mid is its centre, to_left and to_up reach
+//from the centre to the left and top edges
+void screen_basis(vect2 view, vect* mid, vect* to_left, vect* to_up) {
     view.psi -= VIEW_HEIGHT / 2.0;
     vect screen_down = angles_to_vect(view);
 
@@ -209,8 +375,25 @@ vect** init_directions(vect2 view) {
 
     vect screen_mid_vert = vect_scale(0.5, vect_add(screen_up, screen_down));
     vect screen_mid_hor = vect_scale(0.5, vect_add(screen_left, screen_right));
-    vect mid_to_left = vect_sub(screen_left, screen_mid_hor);
-    vect mid_to_up = vect_sub(screen_up, screen_mid_vert);
+    *mid = screen_mid_hor;
+    *to_left = vect_sub(screen_left, screen_mid_hor);
+    *to_up = vect_sub(screen_up, screen_mid_vert);
+}
+
+//unit direction of the ray through pixel (x_pix, y_pix)
+vect pixel_direction(vect mid, vect to_left, vect to_up, int x_pix, int y_pix) {
+    vect tmp = vect_add(vect_add(mid, to_left), to_up);
+    tmp = vect_sub(tmp, vect_scale(((float)x_pix / (X_PIXELS - 1)) * 2, to_left));
+    tmp = vect_sub(tmp, vect_scale(((float)y_pix / (Y_PIXELS - 1)) * 2, to_up));
+    vect_normalize(&tmp);
+    return tmp;
+}
+
+//initializes a 2D array of direction vectors for each pixel on a screen, based on a given camera/view orientation (vect2 view)
+//chatgpt'ed this logic cus it was taking too long
+vect** init_directions(vect2 view) {
+    vect screen_mid_hor, mid_to_left, mid_to_up;
+    screen_basis(view, &screen_mid_hor, &mid_to_left, &mid_to_up);
 
     vect** dir = malloc(sizeof(vect*) * Y_PIXELS);
     if (dir == NULL) {
@@ -228,11 +411,7 @@ vect** init_directions(vect2 view) {
 
     for (int y_pix = 0; y_pix < Y_PIXELS; y_pix++) {
         for (int x_pix = 0; x_pix < X_PIXELS; x_pix++) {
-            vect tmp = vect_add(vect_add(screen_mid_hor, mid_to_left), mid_to_up);
-            tmp = vect_sub(tmp, vect_scale(((float)x_pix / (X_PIXELS - 1)) * 2, mid_to_left));
-            tmp = vect_sub(tmp, vect_scale(((float)y_pix / (Y_PIXELS - 1)) * 2, mid_to_up));
-            vect_normalize(&tmp);
-            dir[y_pix][x_pix] = tmp;
+            dir[y_pix][x_pix] = pixel_direction(screen_mid_hor, mid_to_left, mid_to_up, x_pix, y_pix);
         }
     }
     return dir;
@@ -274,63 +453,401 @@ float min(float a, float b) {
 }
 
 /*
-    it's a classic voxel ray traversal algorithm, used in things like 
-    Minecraft-style rendering or ray marching in a voxel grid.
+    traversal statistics
+
+    built with -DTRACE_STATS the renderer counts the steps each ray takes and the cells it
+    passes through, can show the frame as a cost heatmap ('h') and can log a histogram of
+    both per frame (--trace-log FILE). without the flag the counters compile to nothing.
+*/
+#ifdef TRACE_STATS
+static uint32_t trace_steps = 0;   // steps taken by the ray being traced
+static uint32_t trace_cells = 0;   // cells entered by the ray being traced
+#define TRACE_STEP() (trace_steps++)
+#define TRACE_CELL() (trace_cells++)
+#else
+#define TRACE_STEP() ((void)0)
+#define TRACE_CELL() ((void)0)
+#endif
+
+/*
+    block types
+
+    every kind of block is described once in a registry: its glyph, colour and how it
+    behaves for rays and for walking. the registry is compiled into tables indexed by the
+    glyph, so the traversal does one lookup per cell whatever blocks have been added.
+    glyphs nobody registered are plain opaque blocks, like everything was before.
+*/
+#define SAND ':'
+#define WATER '~'
+#define GLASS '='
+#define MAX_BLOCK_TYPES 32
+#define TINT_FULL 255             // accumulated tint at which a medium hides what's behind it
+
+enum block_flags {
+    BLOCK_SOLID = 1,              // can't be walked through
+    BLOCK_OPAQUE = 2,             // stops rays and shades its neighbours
+    BLOCK_TRANSPARENT = 4,        // rays go on through it, picking up its tint
+    BLOCK_OUTLINED = 8,           // edges are drawn with '-'
+};
+
+struct TickContext;
+typedef void (*block_tick_fn)(struct TickContext* ctx, int x, int y, int z);
+
+typedef struct BlockType {
+    const char* name;
+    char glyph;
+    int flags;
+    int tint;                     // how much of TINT_FULL a ray picks up per block crossed
+    int colour;                   // ANSI colour, 0 for the terminal's default
+    const char* shades;           // glyphs for ambient occlusion levels 1..3, NULL for none
+    int tick_delay;               // ticks after being placed that on_tick runs, 0 for never
+    block_tick_fn on_tick;        // scheduled update
+    block_tick_fn on_random_tick; // runs when a random tick picks a block of this type
+} block_type;
+
+typedef struct BlockTables {
+    uint8_t flags[256];
+    uint8_t tint[256];
+    uint8_t colour[256];          // colour of every glyph a block can be drawn with
+    char shades[256][3];
+    int tick_delay[256];
+    block_tick_fn on_tick[256];
+    block_tick_fn on_random_tick[256];
+} block_tables;
+
+static block_type block_types[MAX_BLOCK_TYPES];
+static int block_type_count = 0;
+static block_tables block_lut;
+
+const block_type* find_block_type(char glyph) {
+    for (int i = 0; i < block_type_count; i++) {
+        if (block_types[i].glyph == glyph) return &block_types[i];
+    }
+    return NULL;
+}
+
+//rebuild the lookup tables from the registry
+void compile_block_tables() {
+    memset(&block_lut, 0, sizeof(block_lut));
+    for (int c = 0; c < 256; c++) {
+        if (c != ' ') block_lut.flags[c] = BLOCK_SOLID | BLOCK_OPAQUE | BLOCK_OUTLINED;
+    }
+    for (int i = 0; i < block_type_count; i++) {
+        const block_type* type = &block_types[i];
+        unsigned char g = (unsigned char)type->glyph;
+        block_lut.flags[g] = (uint8_t)type->flags;
+        block_lut.tint[g] = (uint8_t)type->tint;
+        block_lut.colour[g] = (uint8_t)type->colour;
+        block_lut.tick_delay[g] = type->tick_delay;
+        block_lut.on_tick[g] = type->on_tick;
+        block_lut.on_random_tick[g] = type->on_random_tick;
+        if (type->shades != NULL) {
+            for (int level = 0; level < 3; level++) {
+                block_lut.shades[g][level] = type->shades[level];
+                block_lut.colour[(unsigned char)type->shades[level]] = (uint8_t)type->colour;
+            }
+        }
+    }
+}
+
+//add or redefine a block type, returns 0 or -1 when the registry is full
+int register_block_type(block_type type) {
+    block_type* slot = (block_type*)find_block_type(type.glyph);
+    if (slot == NULL) {
+        if (block_type_count == MAX_BLOCK_TYPES) return -1;
+        slot = &block_types[block_type_count++];
+    }
+    *slot = type;
+    compile_block_tables();
+    return 0;
+}
+
+void init_block_types() {
+    int opaque = BLOCK_SOLID | BLOCK_OPAQUE | BLOCK_OUTLINED;
+    register_block_type((block_type){ .name = "air", .glyph = ' ' });
+    register_block_type((block_type){ .name = "ground", .glyph = '@', .flags = opaque, .shades = "%*+" });
+    register_block_type((block_type){ .name = "sand", .glyph = SAND, .flags = opaque, .colour = 33, .shades = ";,." });
+    register_block_type((block_type){ .name = "water", .glyph = WATER, .flags = BLOCK_TRANSPARENT, .tint = 96,
+        .colour = 34 });
+    register_block_type((block_type){ .name = "glass", .glyph = GLASS,
+        .flags = BLOCK_SOLID | BLOCK_TRANSPARENT | BLOCK_OUTLINED, .tint = 24, .colour = 36 });
+}
+
+/*
+    ambient occlusion
+
+    every face of every block keeps how much each of its four corners is hemmed in by the
+    blocks around it (0 open .. 3 fully occluded, two bits per corner, one byte per face).
+    the values are computed once for the world and then only for the faces around edited
+    blocks, so at a hit the renderer just reads the face's byte and interpolates its corners.
+    what the levels look like is up to the block type's shades.
 */
-char raytrace(vect pos, vect dir, char*** blocks) {
+typedef struct AmbientOcclusion {
+    char*** blocks;           // the world this cache belongs to
+    uint8_t* faces;           // 6 bytes per block: -x, +x, -y, +y, -z, +z
+} ambient_occlusion;
+
+static ambient_occlusion ao = { NULL, NULL };
+
+//glyph for a hit at pos on block (x, y, z) entered along dir
+static inline char ao_shade(char c, vect pos, vect dir, int x, int y, int z) {
+    float fx = pos.x - x, fy = pos.y - y, fz = pos.z - z;
+    // the face the ray came in through is the one it's closest to on the side it came from
+    float dx = dir.x > 0 ? fx : 1 - fx;
+    float dy = dir.y > 0 ? fy : 1 - fy;
+    float dz = dir.z > 0 ? fz : 1 - fz;
+    int face;
+    float u, v;
+    if (dx <= dy && dx <= dz) {
+        face = dir.x > 0 ? 0 : 1;
+        u = fy;
+        v = fz;
+    }
+    else if (dy <= dz) {
+        face = dir.y > 0 ? 2 : 3;
+        u = fx;
+        v = fz;
+    }
+    else {
+        face = dir.z > 0 ? 4 : 5;
+        u = fx;
+        v = fy;
+    }
+    uint8_t corners = ao.faces[(((size_t)z * Y_BLOCKS + y) * X_BLOCKS + x) * 6 + face];
+    if (corners == 0) return c;
+    float c00 = corners & 3, c10 = (corners >> 2) & 3, c01 = (corners >> 4) & 3, c11 = corners >> 6;
+    // barycentric interpolation over the triangle of the quad the hit lies in
+    float occlusion = u >= v ? c00 + u * (c10 - c00) + v * (c11 - c10)
+                             : c00 + v * (c01 - c00) + u * (c11 - c01);
+    int level = (int)(occlusion + 0.5f);
+    return level == 0 ? c : block_lut.shades[(unsigned char)c][level - 1];
+}
+
+//fill in the depth and cell channels for a ray from origin that stopped at pos in cell at
+static inline void ray_surface(vect origin, vect pos, int32_t at, float* depth, int32_t* cell) {
+    vect d = vect_sub(pos, origin);
+    *depth = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+    *cell = at;
+}
+
+//how far along dir the ray has to move to get just past the nearest cell boundary
+static inline __attribute__((always_inline))
+float ray_step(vect pos, vect dir) {
     float eps = 0.01;
-    while (!ray_outside(pos)) {
+    float dist = 2;
+    if (dir.x > eps) {
+        dist = min(dist, ((int)(pos.x + 1) - pos.x) / dir.x);
+    }
+    else if (dir.x < -eps) {
+        dist = min(dist, ((int)pos.x - pos.x) / dir.x);
+    }
+    if (dir.y > eps) {
+        dist = min(dist, ((int)(pos.y + 1) - pos.y) / dir.y);
+    }
+    else if (dir.y < -eps) {
+        dist = min(dist, ((int)pos.y - pos.y) / dir.y);
+    }
+    if (dir.z > eps) {
+        dist = min(dist, ((int)(pos.z + 1) - pos.z) / dir.z);
+    }
+    else if (dir.z < -eps) {
+        dist = min(dist, ((int)pos.z - pos.z) / dir.z);
+    }
+    return dist + eps;
+}
+
+/*
+    the cell walk shared by the renderer and the raycast queries, so both see exactly the same
+    cells. it hands every cell the ray is in to visit, which returns nonzero to stop the ray
+    there. with max_distance set the ray stops before a step that would take it further.
+    returns 1 if visit stopped it, 0 if it left the world or ran out of distance, and leaves
+    where it stopped in *pos and how far it went (in multiples of |dir|) in *travelled.
+*/
+typedef int (*ray_visit_fn)(void* ctx, vect pos, int x, int y, int z);
+
+static inline __attribute__((always_inline))
+int ray_walk(vect* pos, vect dir, float max_distance, ray_visit_fn visit, void* ctx, float* travelled) {
+    int x_blocks = X_BLOCKS, y_blocks = Y_BLOCKS, z_blocks = Z_BLOCKS;
+    vect p = *pos;
+    float t = 0;
+    int stopped = 0;
+    while (!(p.x >= x_blocks || p.y >= y_blocks || p.z >= z_blocks
+        || p.x < 0 || p.y < 0 || p.z < 0)) {
         // Check bounds before accessing
-        int z = (int)pos.z;
-        int y = (int)pos.y;
-        int x = (int)pos.x;
-        
-        if (z < 0 || z >= Z_BLOCKS || y < 0 || y >= Y_BLOCKS || x < 0 || x >= X_BLOCKS) {
+        int z = (int)p.z;
+        int y = (int)p.y;
+        int x = (int)p.x;
+        if (z < 0 || z >= z_blocks || y < 0 || y >= y_blocks || x < 0 || x >= x_blocks) {
             break;
         }
-        
-        char c = blocks[z][y][x];
-        if (c != ' ') {
-            if (on_block_border(pos)) {
-                return '-';
-            }
-            else {
-                return c;
-            }
-        }
-        float dist = 2;
-        if (dir.x > eps) {
-            dist = min(dist, ((int)(pos.x + 1) - pos.x) / dir.x);
-        }
-        else if (dir.x < -eps) {
-            dist = min(dist, ((int)pos.x - pos.x) / dir.x);
-        }
-        if (dir.y > eps) {
-            dist = min(dist, ((int)(pos.y + 1) - pos.y) / dir.y);
+        if (visit(ctx, p, x, y, z)) {
+            stopped = 1;
+            break;
         }
-        else if (dir.y < -eps) {
-            dist = min(dist, ((int)pos.y - pos.y) / dir.y);
+        float step = ray_step(p, dir);
+        if (max_distance > 0 && t + step > max_distance) break;
+        p = vect_add(p, vect_scale(step, dir));
+        t += step;
+    }
+    *pos = p;
+    *travelled = t;
+    return stopped;
+}
+
+/*
+    it's a classic voxel ray traversal algorithm, used in things like 
+    Minecraft-style rendering or ray marching in a voxel grid.
+
+    transparent blocks add their tint as the ray crosses them; once a ray has picked up
+    TINT_FULL the medium is all that can be seen, otherwise whatever is behind shows through
+    in the colour of the medium. besides the glyph the ray reports its colour, how far it
+    went and which cell it stopped in.
+*/
+typedef struct RaytraceState {
+    char*** blocks;
+    vect origin;
+    vect dir;
+    int tint;
+    char medium;
+    const char* tinted;           // last transparent cell the ray picked up tint from
+    char glyph;                   // what the pixel shows once the ray stopped
+    float* depth;
+    int32_t* cell;
+    uint8_t* colour;
+#ifdef TRACE_STATS
+    int last_cell;
+#endif
+} raytrace_state;
+
+static inline __attribute__((always_inline))
+int raytrace_visit(void* ctx, vect pos, int x, int y, int z) {
+    raytrace_state* s = ctx;
+    int at = (z * Y_BLOCKS + y) * X_BLOCKS + x;
+    TRACE_STEP();
+#ifdef TRACE_STATS
+    if (at != s->last_cell) {
+        s->last_cell = at;
+        TRACE_CELL();
+    }
+#endif
+    char c = s->blocks[z][y][x];
+    int flags = block_lut.flags[(unsigned char)c];
+    if (!(flags & (BLOCK_OPAQUE | BLOCK_TRANSPARENT))) return 0;
+    if ((flags & BLOCK_OUTLINED) && on_block_border(pos)) {
+        ray_surface(s->origin, pos, at, s->depth, s->cell);
+        *s->colour = block_lut.colour[(unsigned char)(s->tint > 0 ? s->medium : '-')];
+        s->glyph = '-';
+        return 1;
+    }
+    else if (flags & BLOCK_OPAQUE) {
+        ray_surface(s->origin, pos, at, s->depth, s->cell);
+        if (ao.blocks == s->blocks && block_lut.shades[(unsigned char)c][0]) {
+            c = ao_shade(c, pos, s->dir, x, y, z);
         }
-        if (dir.z > eps) {
-            dist = min(dist, ((int)(pos.z + 1) - pos.z) / dir.z);
+        *s->colour = block_lut.colour[(unsigned char)(s->tint > 0 ? s->medium : c)];
+        s->glyph = c;
+        return 1;
+    }
+    else if (&s->blocks[z][y][x] != s->tinted) {
+        s->tinted = &s->blocks[z][y][x];
+        s->medium = c;
+        s->tint += block_lut.tint[(unsigned char)c];
+        if (s->tint >= TINT_FULL) {
+            ray_surface(s->origin, pos, at, s->depth, s->cell);
+            *s->colour = block_lut.colour[(unsigned char)c];
+            s->glyph = c;
+            return 1;
         }
-        else if (dir.z < -eps) {
-            dist = min(dist, ((int)pos.z - pos.z) / dir.z);
+    }
+    return 0;
+}
+
+char raytrace(vect pos, vect dir, char*** blocks, float* depth, int32_t* cell, uint8_t* colour) {
+    raytrace_state s = { .blocks = blocks, .origin = pos, .dir = dir, .medium = ' ', .depth = depth, .cell = cell,
+        .colour = colour };
+#ifdef TRACE_STATS
+    s.last_cell = -1;
+#endif
+    float travelled;
+    if (ray_walk(&pos, dir, 0, raytrace_visit, &s, &travelled)) return s.glyph;
+    *depth = FRAME_FAR;
+    *cell = FRAME_NO_CELL;
+    *colour = block_lut.colour[(unsigned char)s.medium];
+    return s.tint > 0 ? s.medium : ' ';
+}
+
+#ifdef TRACE_STATS
+#define TRACE_HIST_BUCKETS 64   // the last bucket counts every ray that took longer
+
+typedef struct TraceStats {
+    uint16_t* steps;          // per pixel, last frame
+    uint16_t* cells;
+    int width;
+    int height;
+    uint32_t step_hist[TRACE_HIST_BUCKETS];
+    uint32_t cell_hist[TRACE_HIST_BUCKETS];
+    uint64_t total_steps;
+    uint64_t total_cells;
+    uint32_t max_steps;
+    uint32_t frame;
+    FILE* log;
+} trace_stats;
+
+static trace_stats stats = { 0 };
+
+//size the per pixel buffers to the frame and clear the histograms
+void trace_stats_begin_frame() {
+    if (stats.width != X_PIXELS || stats.height != Y_PIXELS) {
+        stats.width = X_PIXELS;
+        stats.height = Y_PIXELS;
+        stats.steps = realloc(stats.steps, sizeof(uint16_t) * X_PIXELS * Y_PIXELS);
+        stats.cells = realloc(stats.cells, sizeof(uint16_t) * X_PIXELS * Y_PIXELS);
+        if (stats.steps == NULL || stats.cells == NULL) {
+            perror("Failed to allocate trace stats");
+            exit(EXIT_FAILURE);
         }
-        pos = vect_add(pos, vect_scale(dist + eps, dir));
     }
-    return ' ';
+    memset(stats.step_hist, 0, sizeof(stats.step_hist));
+    memset(stats.cell_hist, 0, sizeof(stats.cell_hist));
+    stats.total_steps = 0;
+    stats.total_cells = 0;
+    stats.max_steps = 0;
+    trace_steps = 0;
+    trace_cells = 0;
+}
+
+//file the counters of the ray just traced under pixel (x, y)
+void trace_stats_record(int x, int y) {
+    size_t i = (size_t)y * X_PIXELS + x;
+    stats.steps[i] = trace_steps > UINT16_MAX ? UINT16_MAX : trace_steps;
+    stats.cells[i] = trace_cells > UINT16_MAX ? UINT16_MAX : trace_cells;
+    stats.step_hist[trace_steps < TRACE_HIST_BUCKETS ? trace_steps : TRACE_HIST_BUCKETS - 1]++;
+    stats.cell_hist[trace_cells < TRACE_HIST_BUCKETS ? trace_cells : TRACE_HIST_BUCKETS - 1]++;
+    stats.total_steps += trace_steps;
+    stats.total_cells += trace_cells;
+    if (trace_steps > stats.max_steps) stats.max_steps = trace_steps;
+    trace_steps = 0;
+    trace_cells = 0;
 }
+#endif
 
 /*
     part of the ASCII raytracer pipeline that takes the player's position and view, 
     traces rays into the 3D world, and fills in a 2D ASCII picture.
 */
-void get_picture(char** picture, player_pos_view posview, char*** blocks) {
+void get_picture(framebuffer* picture, player_pos_view posview, char*** blocks) {
     vect** directions = init_directions(posview.view);
+#ifdef TRACE_STATS
+    trace_stats_begin_frame();
+#endif
     for(int y = 0; y < Y_PIXELS; y++) {
         for(int x = 0; x < X_PIXELS; x++) {
-            picture[y][x] = raytrace(posview.pos, directions[y][x], blocks);
+            size_t i = (size_t)y * X_PIXELS + x;
+            picture->glyph[i] = raytrace(posview.pos, directions[y][x], blocks, &picture->depth[i],
+                &picture->cell[i], &picture->colour[i]);
+#ifdef TRACE_STATS
+            trace_stats_record(x, y);
+#endif
         }
     }
     
@@ -341,272 +858,4281 @@ void get_picture(char** picture, player_pos_view posview, char*** blocks) {
     free(directions);
 }
 
+/*
+    overlays
+
+    drawn over a finished picture, so nothing in the world has to change to show them. the
+    selection is a block sized box intersected with every pixel's ray and only drawn where it
+    is nearer than what the pixel already shows. the crosshair and the status line go on top
+    of everything and leave depth and cell alone, they don't stand for anything in the world.
+*/
+#define SELECTION_GLYPH 'o'
+#define SELECTION_COLOUR 32
+#define CROSSHAIR_GLYPH '+'
+#define CROSSHAIR_COLOUR 97
+
+//narrow [enter, leave] to where a ray from o along d is between lo and hi on one axis,
+//returns 0 once nothing is left
+int clip_slab(float o, float d, float lo, float hi, float* enter, float* leave) {
+    if (d == 0) {
+        return o >= lo && o < hi;
+    }
+    float t0 = (lo - o) / d;
+    float t1 = (hi - o) / d;
+    if (t0 > t1) {
+        float t = t0;
+        t0 = t1;
+        t1 = t;
+    }
+    if (t0 > *enter) *enter = t0;
+    if (t1 < *leave) *leave = t1;
+    return *enter <= *leave;
+}
+
+//a . (b x c)
+float triple_product(vect a, vect b, vect c) {
+    return a.x * (b.y * c.z - b.z * c.y) + a.y * (b.z * c.x - b.x * c.z) + a.z * (b.x * c.y - b.y * c.x);
+}
+
+//the pixels the block at (x, y, z) can cover, found by solving where the ray through each of
+//its corners crosses the screen. if a corner isn't in front of the camera it's the whole screen
+void selection_bounds(framebuffer* picture, player_pos_view posview, vect mid, vect to_left, vect to_up,
+    int x, int y, int z, int* x0, int* y0, int* x1, int* y1) {
+    *x0 = 0;
+    *y0 = 0;
+    *x1 = picture->width;
+    *y1 = picture->height;
+    // a pixel's ray runs along top_left - 2a * to_left - 2b * to_up for a, b in [0, 1]
+    vect top_left = vect_add(vect_add(mid, to_left), to_up);
+    float det = triple_product(top_left, to_left, to_up);
+    if (fabsf(det) < 1e-12f) return;
+    float lo_x = FRAME_FAR, lo_y = FRAME_FAR, hi_x = -FRAME_FAR, hi_y = -FRAME_FAR;
+    for (int corner = 0; corner < 8; corner++) {
+        vect c = { x + (corner & 1), y + (corner >> 1 & 1), z + (corner >> 2) };
+        vect v = vect_sub(c, posview.pos);
+        float along = triple_product(v, to_left, to_up) / det;
+        if (along < 1e-3f) return;
+        float a = -triple_product(top_left, v, to_up) / det / (2 * along) * (picture->width - 1);
+        float b = -triple_product(top_left, to_left, v) / det / (2 * along) * (picture->height - 1);
+        lo_x = min(lo_x, a);
+        lo_y = min(lo_y, b);
+        hi_x = a > hi_x ? a : hi_x;
+        hi_y = b > hi_y ? b : hi_y;
+    }
+    // a pixel of slack for rounding
+    if (lo_x > 1) *x0 = lo_x < picture->width ? (int)lo_x - 1 : picture->width;
+    if (lo_y > 1) *y0 = lo_y < picture->height ? (int)lo_y - 1 : picture->height;
+    if (hi_x < picture->width - 2) *x1 = hi_x > -2 ? (int)hi_x + 2 : 0;
+    if (hi_y < picture->height - 2) *y1 = hi_y > -2 ? (int)hi_y + 2 : 0;
+}
+
+//outline the block at (x, y, z) wherever it isn't hidden behind other blocks
+void draw_selection(framebuffer* picture, player_pos_view posview, int x, int y, int z) {
+    float eps = 0.01;
+    vect mid, to_left, to_up;
+    screen_basis(posview.view, &mid, &to_left, &to_up);
+    int x0, y0, x1, y1;
+    selection_bounds(picture, posview, mid, to_left, to_up, x, y, z, &x0, &y0, &x1, &y1);
+    int32_t cell = (z * Y_BLOCKS + y) * X_BLOCKS + x;
+    for (int py = y0; py < y1; py++) {
+        for (int px = x0; px < x1; px++) {
+            vect dir = pixel_direction(mid, to_left, to_up, px, py);
+            float enter = 0, leave = FRAME_FAR;
+            if (!clip_slab(posview.pos.x, dir.x, x, x + 1, &enter, &leave)
+                || !clip_slab(posview.pos.y, dir.y, y, y + 1, &enter, &leave)
+                || !clip_slab(posview.pos.z, dir.z, z, z + 1, &enter, &leave)) {
+                continue;
+            }
+            size_t i = (size_t)py * picture->width + px;
+            if (enter > picture->depth[i] && picture->cell[i] != cell) {
+                continue;   // something nearer is in the way
+            }
+            // look at the box where the renderer would, just past the face the ray comes in through
+            // or right at the camera if it's inside the box
+            vect at = enter > 0 ? vect_add(posview.pos, vect_scale(enter + eps, dir)) : posview.pos;
+            int border = on_block_border(at);
+            picture->glyph[i] = border ? '-' : SELECTION_GLYPH;
+            picture->colour[i] = border ? block_lut.colour['-'] : SELECTION_COLOUR;
+            picture->depth[i] = enter;
+            picture->cell[i] = cell;
+        }
+    }
+}
+
+//mark the middle of the screen, which is where blocks are targeted
+void draw_crosshair(framebuffer* picture) {
+    size_t i = (size_t)((picture->height - 1) / 2) * picture->width + (picture->width - 1) / 2;
+    picture->glyph[i] = CROSSHAIR_GLYPH;
+    picture->colour[i] = CROSSHAIR_COLOUR;
+}
+
+//write a line of text over the bottom row, cut off at the right edge
+void draw_status(framebuffer* picture, const char* text) {
+    size_t row = (size_t)(picture->height - 1) * picture->width;
+    for (int x = 0; x < picture->width && text[x] != '\0'; x++) {
+        picture->glyph[row + x] = text[x];
+        picture->colour[row + x] = 0;
+    }
+}
+
 /*
     performs ray tracing in a 3D voxel grid (blocks) to determine
     what the ray hits first when cast from a point pos in direction dir
 */
-void draw_ascii(char** picture) {
+void draw_ascii(framebuffer* picture) {
     fflush(stdout);
     printf("\033[0;0H");
-    for (int i = 0; i < Y_PIXELS; i++) {
+    for (int i = 0; i < picture->height; i++) {
         int current_color = 0;
-        for (int j = 0; j < X_PIXELS; j++) {
-            if (picture[i][j] == 'o' && current_color != 32) {
-                printf("\x1B[32m");
-                current_color = 32;
+        for (int j = 0; j < picture->width; j++) {
+            size_t at = (size_t)i * picture->width + j;
+            int color = picture->colour[at];
+            if (color != current_color) {
+                if (color) printf("\x1B[%dm", color);
+                else printf("\x1B[0m");
+                current_color = color;
             }
-            else if (picture[i][j] != 'o' && current_color != 0) {
-                printf("\x1B[0m");
-                current_color = 0;
-            }
-            printf("%c", picture[i][j]);
+            printf("%c", picture->glyph[at]);
         }
         printf("\x1B[0m\n");
     }
 }
 
-// Function to update the player's position and viewing direction based on input
-void update_pos_view(player_pos_view* posview, char*** blocks) {
-    float move_eps = 0.30;  // Movement speed
-    float tilt_eps = 0.1;   // Rotation speed
-    
-    // Check bounds before casting to int
-    int x = (int)posview->pos.x;
-    int y = (int)posview->pos.y;
-    int z = (int)posview->pos.z - EYE_HEIGHT + 0.01;
-    
-    // Ensure we're within bounds
-    if (x >= 0 && x < X_BLOCKS && y >= 0 && y < Y_BLOCKS && z >= 0 && z < Z_BLOCKS) {
-        // Push player upward if embedded in a block
-        if (blocks[z][y][x] != ' ') {
-            posview->pos.z += 1;
+#ifdef TRACE_STATS
+//draw the last frame's steps per ray, scaled to the most expensive ray
+void draw_heatmap() {
+    static const char ramp[] = " .:-=+*#%@";
+    static const int colors[] = { 17, 19, 21, 27, 33, 39, 46, 226, 208, 196 };
+    uint32_t top = stats.max_steps > 0 ? stats.max_steps : 1;
+    fflush(stdout);
+    printf("\033[0;0H");
+    for (int y = 0; y < stats.height; y++) {
+        int current_level = -1;
+        for (int x = 0; x < stats.width; x++) {
+            int level = (int)((uint32_t)stats.steps[(size_t)y * stats.width + x] * 9 / top);
+            if (level != current_level) {
+                printf("\x1B[38;5;%dm", colors[level]);
+                current_level = level;
+            }
+            putchar(ramp[level]);
         }
+        printf("\x1B[0m\n");
     }
+    uint64_t rays = (uint64_t)stats.width * stats.height;
+    printf("steps/ray mean %.2f max %u, cells/ray mean %.2f", (double)stats.total_steps / rays,
+        stats.max_steps, (double)stats.total_cells / rays);
+}
 
-    z = (int)posview->pos.z - EYE_HEIGHT - 0.01;
-    if (x >= 0 && x < X_BLOCKS && y >= 0 && y < Y_BLOCKS && z >= 0 && z < Z_BLOCKS) {
-        // Push player downward if floating above empty space
-        if (blocks[z][y][x] == ' ') {
-            posview->pos.z -= 1;
-        }
+//append the last frame's histograms to the trace log as one CSV line:
+//frame, rays, total steps, total cells, max steps, then the step and cell histograms
+void trace_stats_log_frame() {
+    if (stats.log == NULL) return;
+    fprintf(stats.log, "%u,%d,%llu,%llu,%u", stats.frame, stats.width * stats.height,
+        (unsigned long long)stats.total_steps, (unsigned long long)stats.total_cells, stats.max_steps);
+    for (int i = 0; i < TRACE_HIST_BUCKETS; i++) fprintf(stats.log, ",%u", stats.step_hist[i]);
+    for (int i = 0; i < TRACE_HIST_BUCKETS; i++) fprintf(stats.log, ",%u", stats.cell_hist[i]);
+    fputc('\n', stats.log);
+    stats.frame++;
+}
+#endif
+
+//free an image buffer made by init_picture
+void free_picture(framebuffer* picture) {
+    free(picture);
+}
+
+//monotonic clock in microseconds, used to timestamp frames
+uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//sleep until an absolute time on the monotonic clock
+void sleep_until_ns(int64_t deadline) {
+    struct timespec ts = { (time_t)(deadline / 1000000000), (long)(deadline % 1000000000) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
     }
+}
 
-    // Adjust the view angles based on rotation key inputs
-    if (is_key_pressed('w')) posview->view.psi += tilt_eps;
-    if (is_key_pressed('s')) posview->view.psi -= tilt_eps;
-    if (is_key_pressed('d')) posview->view.phi += tilt_eps;
-    if (is_key_pressed('a')) posview->view.phi -= tilt_eps;
+/*
+    frame pacing
 
-    // Clamp psi to prevent over-rotation
-    if (posview->view.psi > M_PI/2) posview->view.psi = M_PI/2;
-    if (posview->view.psi < -M_PI/2) posview->view.psi = -M_PI/2;
+    every frame has a deadline by which it should be on screen, one period after the last.
+    instead of rendering straight away and then idling, the loop sleeps until just before
+    the deadline, leaving as much time as frames have been taking, and only then reads the
+    input, so keys wait as little as possible before they show up. the estimate of the frame
+    time jumps up at once when a frame runs long and only creeps back down, so a slow frame
+    doesn't make the next one late too. frames that can't make their deadline start at once.
+*/
+#define DEFAULT_FPS 50
+#define PACER_MARGIN_NS 1000000   // slack on top of the estimated frame time
 
-    // Calculate movement direction from angles
-    vect direction = angles_to_vect(posview->view);
+typedef struct FramePacer {
+    int64_t period_ns;
+    int64_t deadline_ns;          // when the frame being made should be on screen
+    int64_t work_ns;              // estimated time from waking up to the frame being written
+    int64_t woke_ns;
+} frame_pacer;
 
-    // Move forward/backward/strafe using direction vector
-    if (is_key_pressed('i')) {
-        posview->pos.x += move_eps * direction.x;
-        posview->pos.y += move_eps * direction.y;
-    }
-    if (is_key_pressed('k')) {
-        posview->pos.x -= move_eps * direction.x;
-        posview->pos.y -= move_eps * direction.y;
-    }
-    if (is_key_pressed('j')) {
-        posview->pos.x += move_eps * direction.y;
-        posview->pos.y -= move_eps * direction.x;
-    }
-    if (is_key_pressed('l')) {
-        posview->pos.x -= move_eps * direction.y;
-        posview->pos.y += move_eps * direction.x;
-    }
+void pacer_init(frame_pacer* pacer, int fps) {
+    pacer->period_ns = 1000000000 / fps;
+    pacer->work_ns = 0;
+    pacer->deadline_ns = now_ns() + pacer->period_ns;
+}
 
-    // Clamp position to world bounds
-    if (posview->pos.x < 0) posview->pos.x = 0;
-    if (posview->pos.x >= X_BLOCKS) posview->pos.x = X_BLOCKS - 0.01;
-    if (posview->pos.y < 0) posview->pos.y = 0;
-    if (posview->pos.y >= Y_BLOCKS) posview->pos.y = Y_BLOCKS - 0.01;
-    if (posview->pos.z < EYE_HEIGHT) posview->pos.z = EYE_HEIGHT;
-    if (posview->pos.z >= Z_BLOCKS) posview->pos.z = Z_BLOCKS - 0.01;
+//sleep until it's time to start the next frame
+void pacer_wait(frame_pacer* pacer) {
+    int64_t wake = pacer->deadline_ns - pacer->work_ns - PACER_MARGIN_NS;
+    if (wake > now_ns()) {
+        sleep_until_ns(wake);
+    }
+    pacer->woke_ns = now_ns();
+}
+
+//the frame has been written, learn from how long it took and set the next deadline
+void pacer_frame_done(frame_pacer* pacer) {
+    int64_t now = now_ns();
+    int64_t work = now - pacer->woke_ns;
+    if (work > pacer->work_ns) pacer->work_ns = work;
+    else pacer->work_ns += (work - pacer->work_ns) / 16;
+    pacer->deadline_ns += pacer->period_ns;
+    if (pacer->deadline_ns < now + pacer->work_ns) {
+        pacer->deadline_ns = now + pacer->work_ns;
+    }
+}
+
+/*
+    input latency: time from a key arriving to the first frame that could show it being
+    written to the terminal. the most recent samples are kept for the percentiles.
+*/
+#define LATENCY_SAMPLES 4096
+
+typedef struct LatencyStats {
+    int64_t samples[LATENCY_SAMPLES];
+    uint64_t count;
+} latency_stats;
+
+void latency_record(latency_stats* latency, int64_t arrival_ns) {
+    if (arrival_ns == 0) return;
+    latency->samples[latency->count++ % LATENCY_SAMPLES] = now_ns() - arrival_ns;
+}
+
+int compare_int64(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+void latency_report(latency_stats* latency, FILE* out) {
+    int n = latency->count < LATENCY_SAMPLES ? (int)latency->count : LATENCY_SAMPLES;
+    if (n == 0) {
+        fprintf(out, "no input to measure latency on\n");
+        return;
+    }
+    int64_t* sorted = malloc(n * sizeof(int64_t));
+    if (sorted == NULL) {
+        perror("Failed to allocate latency samples");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(sorted, latency->samples, n * sizeof(int64_t));
+    qsort(sorted, n, sizeof(int64_t), compare_int64);
+    const int percentiles[] = { 50, 90, 99, 100 };
+    fprintf(out, "input to frame latency over %d frames with input:", n);
+    for (int i = 0; i < 4; i++) {
+        int at = (n - 1) * percentiles[i] / 100;
+        fprintf(out, " p%d %.2f ms", percentiles[i], sorted[at] / 1e6);
+    }
+    fprintf(out, "\n");
+    free(sorted);
+}
+
+/*
+    frame recording
+
+    the render thread never copies a frame. once a frame has been drawn its buffer is
+    pushed into a lock-free single-producer/single-consumer ring and a recycled buffer
+    is popped from a second ring to render the next frame into. a background thread
+    drains the first ring, encodes each frame as a keyframe or as a delta against the
+    previous frame, writes it to disk and hands the buffer back through the second ring.
+    if the encoder falls behind the frame is simply not recorded, the game never waits.
+
+    file layout (native byte order):
+        record_file_header
+        record_frame_header + payload, one per frame
+        record_index_entry[], one per keyframe, located by header.index_offset
+
+    a frame is recorded as two planes, its glyphs followed by their colours, so playback shows
+    exactly what was drawn. payloads are run length encoded. keyframes encode the raw planes,
+    deltas encode the XOR against the previous frame, which is mostly zero and collapses into
+    long runs.
+*/
+#define RECORD_RING_SIZE 8            // buffers in flight between render and encoder, power of two
+#define RECORD_KEYFRAME_INTERVAL 60   // a keyframe every N frames bounds the cost of a seek
+#define RECORD_MAGIC "MCREC02"          // 01 recorded glyphs only
+#define RECORD_KEYFRAME 'K'
+#define RECORD_DELTA 'D'
+
+typedef struct RecordFileHeader {
+    char magic[8];
+    uint32_t keyframe_interval;
+    uint32_t frame_count;     // patched when the recording is closed
+    uint64_t index_offset;    // 0 if the recording was not closed cleanly
+} record_file_header;
+
+typedef struct RecordFrameHeader {
+    uint64_t time_us;         // time since the start of the recording
+    uint32_t index;
+    uint32_t size;            // payload bytes following this header
+    uint16_t width;
+    uint16_t height;
+    uint8_t type;
+    uint8_t pad[3];
+} record_frame_header;
+
+typedef struct RecordIndexEntry {
+    uint64_t offset;          // file offset of the keyframe's record_frame_header
+    uint32_t index;
+    uint32_t pad;
+} record_index_entry;
+
+typedef struct FrameRing {
+    framebuffer* frames[RECORD_RING_SIZE];
+    uint64_t stamps[RECORD_RING_SIZE];
+    _Atomic size_t head;      // only written by the producer
+    _Atomic size_t tail;      // only written by the consumer
+} frame_ring;
+
+//push a frame into the ring, returns 0 if the ring is full
+int ring_push(frame_ring* ring, framebuffer* frame, uint64_t stamp) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == RECORD_RING_SIZE) {
+        return 0;
+    }
+    ring->frames[head & (RECORD_RING_SIZE - 1)] = frame;
+    ring->stamps[head & (RECORD_RING_SIZE - 1)] = stamp;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+//pop a frame from the ring, returns 0 if the ring is empty
+int ring_pop(frame_ring* ring, framebuffer** frame, uint64_t* stamp) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail) {
+        return 0;
+    }
+    *frame = ring->frames[tail & (RECORD_RING_SIZE - 1)];
+    if (stamp != NULL) {
+        *stamp = ring->stamps[tail & (RECORD_RING_SIZE - 1)];
+    }
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+typedef struct Recorder {
+    FILE* file;
+    pthread_t thread;
+    atomic_int running;
+    frame_ring filled;        // render thread -> encoder
+    frame_ring spare;         // encoder -> render thread
+    uint64_t start_us;
+    char* previous;           // planes of the last encoded frame, for deltas
+    char* planes;             // planes of the current frame, XORed with the last one for a delta
+    uint8_t* payload;         // encoder output
+    record_index_entry* index;
+    size_t index_count;
+    size_t index_cap;
+    uint32_t frame_count;
+    uint32_t dropped;
+    uint64_t bytes;
+    uint64_t encode_us;
+    uint64_t submit_us;       // time spent in recorder_submit on the render thread
+} recorder;
+
+/*
+    run length encoding of n bytes into out, returns the encoded size.
+    a control byte c < 128 is followed by c + 1 literal bytes,
+    a control byte c >= 128 is followed by one byte repeated c - 125 times.
+    out must hold at least n + n / 128 + 1 bytes.
+*/
+size_t rle_encode(const char* in, size_t n, uint8_t* out) {
+    size_t o = 0;
+    size_t i = 0;
+    size_t literal_start = 0;
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && run < 130 && in[i + run] == in[i]) {
+            run++;
+        }
+        if (run >= 3) {
+            // flush pending literals before the run
+            while (literal_start < i) {
+                size_t len = i - literal_start > 128 ? 128 : i - literal_start;
+                out[o++] = (uint8_t)(len - 1);
+                memcpy(out + o, in + literal_start, len);
+                o += len;
+                literal_start += len;
+            }
+            out[o++] = (uint8_t)(run + 125);
+            out[o++] = (uint8_t)in[i];
+            i += run;
+            literal_start = i;
+        }
+        else {
+            i += run;
+        }
+    }
+    while (literal_start < n) {
+        size_t len = n - literal_start > 128 ? 128 : n - literal_start;
+        out[o++] = (uint8_t)(len - 1);
+        memcpy(out + o, in + literal_start, len);
+        o += len;
+        literal_start += len;
+    }
+    return o;
+}
+
+//decode size bytes of rle into out (n bytes), XORing onto out instead when xor is set.
+//returns 0 on malformed input
+int rle_decode(const uint8_t* in, size_t size, char* out, size_t n, int xor) {
+    size_t i = 0;
+    size_t o = 0;
+    while (i < size) {
+        uint8_t c = in[i++];
+        if (c < 128) {
+            size_t len = (size_t)c + 1;
+            if (i + len > size || o + len > n) return 0;
+            if (xor) {
+                for (size_t k = 0; k < len; k++) out[o + k] ^= in[i + k];
+            }
+            else {
+                memcpy(out + o, in + i, len);
+            }
+            i += len;
+            o += len;
+        }
+        else {
+            size_t len = (size_t)c - 125;
+            if (i >= size || o + len > n) return 0;
+            char v = (char)in[i++];
+            if (!xor) {
+                memset(out + o, v, len);
+            }
+            else if (v != 0) {
+                for (size_t k = 0; k < len; k++) out[o + k] ^= v;
+            }
+            o += len;
+        }
+    }
+    return o == n;
+}
+
+//encode one frame and append it to the recording
+void recorder_encode(recorder* rec, framebuffer* frame, uint64_t stamp) {
+    uint64_t start = now_us();
+    size_t n = (size_t)X_PIXELS * Y_PIXELS;
+    int keyframe = rec->frame_count % RECORD_KEYFRAME_INTERVAL == 0;
+    char* planes = rec->planes;
+
+    memcpy(planes, frame->glyph, n);
+    memcpy(planes + n, frame->colour, n);
+    for (size_t i = 0; i < 2 * n; i++) {
+        char current = planes[i];
+        if (!keyframe) planes[i] ^= rec->previous[i];
+        rec->previous[i] = current;
+    }
+
+    record_frame_header fh = { 0 };
+    fh.time_us = stamp - rec->start_us;
+    fh.index = rec->frame_count;
+    fh.size = (uint32_t)rle_encode(planes, 2 * n, rec->payload);
+    fh.width = X_PIXELS;
+    fh.height = Y_PIXELS;
+    fh.type = keyframe ? RECORD_KEYFRAME : RECORD_DELTA;
+
+    if (keyframe) {
+        if (rec->index_count == rec->index_cap) {
+            rec->index_cap = rec->index_cap ? rec->index_cap * 2 : 64;
+            rec->index = realloc(rec->index, sizeof(record_index_entry) * rec->index_cap);
+            if (rec->index == NULL) {
+                perror("Failed to allocate recording index");
+                exit(EXIT_FAILURE);
+            }
+        }
+        record_index_entry entry = { (uint64_t)ftello(rec->file), rec->frame_count, 0 };
+        rec->index[rec->index_count++] = entry;
+    }
+    fwrite(&fh, sizeof(fh), 1, rec->file);
+    fwrite(rec->payload, 1, fh.size, rec->file);
+
+    rec->frame_count++;
+    rec->bytes += sizeof(fh) + fh.size;
+    rec->encode_us += now_us() - start;
+}
+
+//background thread: drain filled frames, encode them and recycle the buffers
+void* recorder_thread(void* arg) {
+    recorder* rec = arg;
+    struct timespec idle = { 0, 1000000 };
+    for (;;) {
+        framebuffer* frame;
+        uint64_t stamp;
+        if (ring_pop(&rec->filled, &frame, &stamp)) {
+            recorder_encode(rec, frame, stamp);
+            ring_push(&rec->spare, frame, 0);
+        }
+        else if (!atomic_load(&rec->running)) {
+            break;
+        }
+        else {
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+//start recording to path, returns NULL if the file can't be created
+recorder* recorder_open(const char* path) {
+    recorder* rec = calloc(1, sizeof(recorder));
+    if (rec == NULL) {
+        perror("Failed to allocate recorder");
+        exit(EXIT_FAILURE);
+    }
+    rec->file = fopen(path, "wb");
+    if (rec->file == NULL) {
+        perror("Failed to open recording");
+        free(rec);
+        return NULL;
+    }
+    size_t n = 2 * (size_t)X_PIXELS * Y_PIXELS;   // glyph and colour planes
+    rec->previous = malloc(n);
+    rec->planes = malloc(n);
+    rec->payload = malloc(n + n / 128 + 1);
+    if (rec->previous == NULL || rec->planes == NULL || rec->payload == NULL) {
+        perror("Failed to allocate recorder buffers");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < RECORD_RING_SIZE; i++) {
+        ring_push(&rec->spare, init_picture(), 0);
+    }
+
+    record_file_header header = { RECORD_MAGIC, RECORD_KEYFRAME_INTERVAL, 0, 0 };
+    fwrite(&header, sizeof(header), 1, rec->file);
+
+    rec->start_us = now_us();
+    atomic_store(&rec->running, 1);
+    if (pthread_create(&rec->thread, NULL, recorder_thread, rec) != 0) {
+        perror("Failed to start recorder thread");
+        exit(EXIT_FAILURE);
+    }
+    return rec;
+}
+
+/*
+    hand a finished frame to the recorder and return the buffer the next frame should be
+    rendered into. this only moves pointers, if no spare buffer is available the frame is
+    dropped and the caller keeps rendering into the same buffer.
+*/
+framebuffer* recorder_submit(recorder* rec, framebuffer* frame) {
+    uint64_t start = now_us();
+    framebuffer* next;
+    if (!ring_pop(&rec->spare, &next, NULL)) {
+        rec->dropped++;
+        return frame;
+    }
+    // the filled ring can't overflow, it never holds more buffers than the spare ring had
+    ring_push(&rec->filled, frame, start);
+    rec->submit_us += now_us() - start;
+    return next;
+}
+
+//stop the encoder, write the seek index and release the recorder's buffers
+void recorder_close(recorder* rec) {
+    atomic_store(&rec->running, 0);
+    pthread_join(rec->thread, NULL);
+
+    record_file_header header = { RECORD_MAGIC, RECORD_KEYFRAME_INTERVAL, rec->frame_count, 0 };
+    header.index_offset = (uint64_t)ftello(rec->file);
+    fwrite(rec->index, sizeof(record_index_entry), rec->index_count, rec->file);
+    fseeko(rec->file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, rec->file);
+    fclose(rec->file);
+
+    printf("\nrecorded %u frames (%u dropped), %.1f KiB, encode %.2f ms/frame, submit %.2f us/frame\n",
+        rec->frame_count, rec->dropped, rec->bytes / 1024.0,
+        rec->frame_count ? rec->encode_us / 1000.0 / rec->frame_count : 0.0,
+        rec->frame_count ? (double)rec->submit_us / rec->frame_count : 0.0);
+
+    framebuffer* frame;
+    while (ring_pop(&rec->spare, &frame, NULL)) {
+        free_picture(frame);
+    }
+    free(rec->previous);
+    free(rec->planes);
+    free(rec->payload);
+    free(rec->index);
+    free(rec);
+}
+
+/*
+    stream a recording back to the terminal, starting at frame start.
+    the nearest keyframe at or before start is located through the index,
+    recordings that were not closed cleanly are scanned from the beginning.
+*/
+int play_recording(const char* path, uint32_t start) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        perror("Failed to open recording");
+        return EXIT_FAILURE;
+    }
+    record_file_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, RECORD_MAGIC, 8) != 0) {
+        int old = memcmp(header.magic, RECORD_MAGIC, 5) == 0;
+        fprintf(stderr, old ? "%s was recorded by an older version without colours\n" : "%s is not a recording\n",
+            path);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    // seek to the last keyframe at or before the requested frame
+    if (header.index_offset != 0) {
+        record_index_entry entry;
+        uint64_t seek_to = sizeof(header);
+        fseeko(file, (off_t)header.index_offset, SEEK_SET);
+        while (fread(&entry, sizeof(entry), 1, file) == 1 && entry.index <= start) {
+            seek_to = entry.offset;
+        }
+        fseeko(file, (off_t)seek_to, SEEK_SET);
+    }
+
+    init_terminal();
+    size_t n = 0;
+    framebuffer* frame = NULL;
+    char* planes = NULL;      // glyphs then colours, deltas are XORed onto them
+    uint8_t* payload = NULL;
+    size_t payload_cap = 0;
+    int have_keyframe = 0;
+    uint64_t first_time = 0;
+    uint64_t wall_start = 0;
+    record_frame_header fh;
+
+    while (fread(&fh, sizeof(fh), 1, file) == 1) {
+        if (header.index_offset != 0 && (uint64_t)ftello(file) > header.index_offset) {
+            break;
+        }
+        if (fh.size > payload_cap) {
+            payload_cap = fh.size;
+            payload = realloc(payload, payload_cap);
+            if (payload == NULL) {
+                perror("Failed to allocate payload");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (fread(payload, 1, fh.size, file) != fh.size) {
+            break;
+        }
+        if (fh.width != X_PIXELS || fh.height != Y_PIXELS || frame == NULL) {
+            // show the recording at the size it was made with
+            if (fh.type != RECORD_KEYFRAME) continue;
+            dims.x_pixels = fh.width;
+            dims.y_pixels = fh.height;
+            n = (size_t)X_PIXELS * Y_PIXELS;
+            free_picture(frame);
+            frame = init_picture();
+            planes = realloc(planes, 2 * n);
+            if (planes == NULL) {
+                perror("Failed to allocate playback frame");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (fh.type == RECORD_KEYFRAME) {
+            have_keyframe = rle_decode(payload, fh.size, planes, 2 * n, 0);
+            if (!have_keyframe) continue;
+        }
+        else if (!have_keyframe || !rle_decode(payload, fh.size, planes, 2 * n, 1)) {
+            continue;
+        }
+        if (fh.index < start) {
+            continue;
+        }
+
+        // pace playback against the recorded timestamps
+        if (wall_start == 0) {
+            wall_start = now_us();
+            first_time = fh.time_us;
+        }
+        uint64_t due = wall_start + (fh.time_us - first_time);
+        if (due > now_us()) {
+            sleep_until_ns((int64_t)due * 1000);
+        }
+
+        memcpy(frame->glyph, planes, n);
+        memcpy(frame->colour, planes + n, n);
+        draw_ascii(frame);
+        printf("frame %u", fh.index);
+
+        process_input();
+        if (is_key_pressed('q')) break;
+    }
+
+    free_picture(frame);
+    free(planes);
+    free(payload);
+    fclose(file);
+    restore_terminal();
+    return EXIT_SUCCESS;
+}
+
+/*
+    worker pool
+
+    a fixed set of threads that run the iterations of parallel_for. the calling thread
+    takes part in the work too, so with a single core everything simply runs inline.
+    parallel_for is only ever called from the game loop thread.
+*/
+#define MAX_WORKERS 16
+
+typedef void (*job_fn)(void* ctx, int index);
+
+typedef struct WorkerPool {
+    pthread_t threads[MAX_WORKERS];
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    job_fn fn;
+    void* ctx;
+    int jobs;
+    atomic_int next;          // next job index to hand out
+    int busy;                 // workers still working on the current batch
+    unsigned generation;      // bumped for every batch so workers notice new work
+    int quit;
+} worker_pool;
+
+static worker_pool pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER };
+
+//take jobs from the current batch until none are left
+void pool_drain(job_fn fn, void* ctx, int jobs) {
+    int i;
+    while ((i = atomic_fetch_add(&pool.next, 1)) < jobs) {
+        fn(ctx, i);
+    }
+}
+
+void* pool_worker(void* arg) {
+    (void)arg;
+    unsigned seen = 0;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.generation == seen && !pool.quit) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        }
+        if (pool.quit) break;
+        seen = pool.generation;
+        job_fn fn = pool.fn;
+        void* ctx = pool.ctx;
+        int jobs = pool.jobs;
+        pthread_mutex_unlock(&pool.lock);
+
+        pool_drain(fn, ctx, jobs);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.busy == 0) {
+            pthread_cond_signal(&pool.done);
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+//start one worker per extra core
+void pool_init() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int count = cores > 1 ? (int)cores - 1 : 0;
+    if (count > MAX_WORKERS) count = MAX_WORKERS;
+    for (int i = 0; i < count; i++) {
+        if (pthread_create(&pool.threads[i], NULL, pool_worker, NULL) != 0) {
+            break;
+        }
+        pool.count++;
+    }
+}
+
+void pool_shutdown() {
+    pthread_mutex_lock(&pool.lock);
+    pool.quit = 1;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+    for (int i = 0; i < pool.count; i++) {
+        pthread_join(pool.threads[i], NULL);
+    }
+    pool.count = 0;
+    pool.quit = 0;
+}
+
+//run fn(ctx, i) for every i in [0, jobs) across the pool and wait for all of them
+void parallel_for(int jobs, job_fn fn, void* ctx) {
+    if (pool.count == 0 || jobs <= 1) {
+        for (int i = 0; i < jobs; i++) {
+            fn(ctx, i);
+        }
+        return;
+    }
+    pthread_mutex_lock(&pool.lock);
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pool.jobs = jobs;
+    atomic_store(&pool.next, 0);
+    pool.busy = pool.count;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    pool_drain(fn, ctx, jobs);
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.busy > 0) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/*
+    region edits
+
+    fill, replace and clone/move work on boxes of blocks. an edit is split into one job
+    per chunk column (CHUNK_SIZE x CHUNK_SIZE blocks, full height) so the jobs never touch
+    the same cells and can run in parallel. rows are written with memset/memcpy, and a box
+    that spans whole planes is written one plane per memset.
+
+    every journaled edit stores the old contents of each job's box run length encoded,
+    so undoing an edit to a mostly uniform area costs a few bytes per chunk.
+*/
+#define CHUNK_SHIFT 2
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+#define X_CHUNKS ((X_BLOCKS + CHUNK_SIZE - 1) / CHUNK_SIZE)
+#define Y_CHUNKS ((Y_BLOCKS + CHUNK_SIZE - 1) / CHUNK_SIZE)
+#define EDIT_JOURNAL_DEPTH 64   // oldest edits are forgotten beyond this
+
+// box of blocks, min corner inclusive, max corner exclusive
+typedef struct Region {
+    int x0, y0, z0;
+    int x1, y1, z1;
+} region;
+
+// old contents of one box, run length encoded
+typedef struct EditPiece {
+    region box;
+    uint8_t* data;
+    size_t size;
+} edit_piece;
+
+// everything needed to undo one edit
+typedef struct EditRecord {
+    edit_piece* pieces;
+    int count;
+    int overlapping;          // pieces may share cells, restore them one at a time
+} edit_record;
+
+typedef struct EditJournal {
+    edit_record records[EDIT_JOURNAL_DEPTH];
+    int count;
+} edit_journal;
+
+enum { EDIT_FILL, EDIT_REPLACE, EDIT_CLONE, EDIT_RESTORE };
+
+typedef struct EditJob {
+    char*** blocks;
+    region* boxes;
+    edit_piece* pieces;       // one per box, NULL if the edit isn't journaled
+    int op;
+    char block;
+    char from;                // EDIT_REPLACE: only blocks of this type change
+    const char* source;       // EDIT_CLONE: gathered source blocks
+    region src;               // EDIT_CLONE: box the source was gathered from
+    int dx, dy, dz;           // EDIT_CLONE: offset from source to destination
+    char** restored;          // EDIT_RESTORE: decoded blocks of each box
+} edit_job;
+
+int region_volume(region r) {
+    if (r.x1 <= r.x0 || r.y1 <= r.y0 || r.z1 <= r.z0) return 0;
+    return (r.x1 - r.x0) * (r.y1 - r.y0) * (r.z1 - r.z0);
+}
+
+//clip a box to the world
+region region_clip(region r) {
+    if (r.x0 < 0) r.x0 = 0;
+    if (r.y0 < 0) r.y0 = 0;
+    if (r.z0 < 0) r.z0 = 0;
+    if (r.x1 > X_BLOCKS) r.x1 = X_BLOCKS;
+    if (r.y1 > Y_BLOCKS) r.y1 = Y_BLOCKS;
+    if (r.z1 > Z_BLOCKS) r.z1 = Z_BLOCKS;
+    return r;
+}
+
+//region spanning a single block
+region region_cell(int x, int y, int z) {
+    region r = { x, y, z, x + 1, y + 1, z + 1 };
+    return r;
+}
+
+/*
+    edit listeners are told about every box of blocks an edit changed, once the edit is done.
+    subsystems that cache something derived from the blocks use this to refresh only what an
+    edit touched. listeners run on the game loop thread.
+*/
+#define MAX_EDIT_LISTENERS 8
+
+typedef void (*edit_listener)(void* ctx, char*** blocks, region changed);
+
+static edit_listener edit_listeners[MAX_EDIT_LISTENERS];
+static void* edit_listener_ctx[MAX_EDIT_LISTENERS];
+static int edit_listener_count = 0;
+
+void add_edit_listener(edit_listener fn, void* ctx) {
+    if (edit_listener_count < MAX_EDIT_LISTENERS) {
+        edit_listeners[edit_listener_count] = fn;
+        edit_listener_ctx[edit_listener_count] = ctx;
+        edit_listener_count++;
+    }
+}
+
+void remove_edit_listener(edit_listener fn, void* ctx) {
+    for (int i = 0; i < edit_listener_count; i++) {
+        if (edit_listeners[i] == fn && edit_listener_ctx[i] == ctx) {
+            edit_listener_count--;
+            edit_listeners[i] = edit_listeners[edit_listener_count];
+            edit_listener_ctx[i] = edit_listener_ctx[edit_listener_count];
+            return;
+        }
+    }
+}
+
+void notify_edit(char*** blocks, region changed) {
+    if (region_volume(changed) == 0) return;
+    for (int i = 0; i < edit_listener_count; i++) {
+        edit_listeners[i](edit_listener_ctx[i], blocks, changed);
+    }
+}
+
+//split a clipped box into independent jobs: one per plane if it spans whole planes,
+//otherwise one per chunk column. returns the number of boxes written to *boxes
+int region_split(region r, region** boxes) {
+    int count = 0;
+    if (r.x0 == 0 && r.x1 == X_BLOCKS && r.y0 == 0 && r.y1 == Y_BLOCKS) {
+        *boxes = malloc(sizeof(region) * (r.z1 - r.z0));
+        if (*boxes == NULL) {
+            perror("Failed to allocate edit jobs");
+            exit(EXIT_FAILURE);
+        }
+        for (int z = r.z0; z < r.z1; z++) {
+            region plane = { r.x0, r.y0, z, r.x1, r.y1, z + 1 };
+            (*boxes)[count++] = plane;
+        }
+        return count;
+    }
+    int cx0 = r.x0 >> CHUNK_SHIFT, cx1 = (r.x1 - 1) >> CHUNK_SHIFT;
+    int cy0 = r.y0 >> CHUNK_SHIFT, cy1 = (r.y1 - 1) >> CHUNK_SHIFT;
+    *boxes = malloc(sizeof(region) * (cx1 - cx0 + 1) * (cy1 - cy0 + 1));
+    if (*boxes == NULL) {
+        perror("Failed to allocate edit jobs");
+        exit(EXIT_FAILURE);
+    }
+    for (int cy = cy0; cy <= cy1; cy++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+            region chunk = { cx << CHUNK_SHIFT, cy << CHUNK_SHIFT, r.z0,
+                (cx + 1) << CHUNK_SHIFT, (cy + 1) << CHUNK_SHIFT, r.z1 };
+            region box = r;
+            if (chunk.x0 > box.x0) box.x0 = chunk.x0;
+            if (chunk.y0 > box.y0) box.y0 = chunk.y0;
+            if (chunk.x1 < box.x1) box.x1 = chunk.x1;
+            if (chunk.y1 < box.y1) box.y1 = chunk.y1;
+            (*boxes)[count++] = box;
+        }
+    }
+    return count;
+}
+
+//copy the blocks of a box into out, row by row
+void region_gather(char*** blocks, region b, char* out) {
+    int w = b.x1 - b.x0;
+    for (int z = b.z0; z < b.z1; z++) {
+        for (int y = b.y0; y < b.y1; y++) {
+            memcpy(out, &blocks[z][y][b.x0], w);
+            out += w;
+        }
+    }
+}
+
+//save the current contents of a box into a journal piece
+void edit_capture(char*** blocks, region b, edit_piece* piece) {
+    size_t n = region_volume(b);
+    char* raw = malloc(n);
+    uint8_t* packed = malloc(n + n / 128 + 1);
+    if (raw == NULL || packed == NULL) {
+        perror("Failed to allocate edit journal");
+        exit(EXIT_FAILURE);
+    }
+    region_gather(blocks, b, raw);
+    piece->box = b;
+    piece->size = rle_encode(raw, n, packed);
+    piece->data = realloc(packed, piece->size);
+    if (piece->data == NULL) {
+        piece->data = packed;
+    }
+    free(raw);
+}
+
+//apply the edit to one job's box, in holds the blocks to restore for EDIT_RESTORE
+void edit_apply(edit_job* job, region b, const char* in) {
+    char*** blocks = job->blocks;
+    int w = b.x1 - b.x0;
+    int whole_planes = w == X_BLOCKS && b.y0 == 0 && b.y1 == Y_BLOCKS;
+
+    for (int z = b.z0; z < b.z1; z++) {
+        if (whole_planes && job->op == EDIT_FILL) {
+            // plane rows are contiguous in the slab
+            memset(blocks[z][0], job->block, (size_t)X_BLOCKS * Y_BLOCKS);
+            continue;
+        }
+        for (int y = b.y0; y < b.y1; y++) {
+            char* row = &blocks[z][y][b.x0];
+            switch (job->op) {
+                case EDIT_FILL:
+                    memset(row, job->block, w);
+                    break;
+                case EDIT_REPLACE:
+                    for (int x = 0; x < w; x++) {
+                        if (row[x] == job->from) row[x] = job->block;
+                    }
+                    break;
+                case EDIT_CLONE: {
+                    const region* s = &job->src;
+                    size_t sw = s->x1 - s->x0, sh = s->y1 - s->y0;
+                    size_t offset = ((size_t)(z - job->dz - s->z0) * sh + (y - job->dy - s->y0)) * sw
+                        + (b.x0 - job->dx - s->x0);
+                    memcpy(row, job->source + offset, w);
+                    break;
+                }
+                case EDIT_RESTORE:
+                    memcpy(row, in, w);
+                    in += w;
+                    break;
+            }
+        }
+    }
+}
+
+void edit_capture_job(void* ctx, int i) {
+    edit_job* job = ctx;
+    edit_capture(job->blocks, job->boxes[i], &job->pieces[i]);
+}
+
+void edit_apply_job(void* ctx, int i) {
+    edit_job* job = ctx;
+    edit_apply(job, job->boxes[i], job->restored ? job->restored[i] : NULL);
+}
+
+//decode the blocks a journal piece saved, leaving NULL if they don't fill its box
+void edit_decode_job(void* ctx, int i) {
+    edit_job* job = ctx;
+    const edit_piece* piece = &job->pieces[i];
+    size_t n = region_volume(piece->box);
+    char* raw = malloc(n);
+    if (raw == NULL) {
+        perror("Failed to allocate undo buffer");
+        exit(EXIT_FAILURE);
+    }
+    if (!rle_decode(piece->data, piece->size, raw, n, 0)) {
+        free(raw);
+        raw = NULL;
+    }
+    job->restored[i] = raw;
+}
+
+//push a new record, forgetting the oldest one if the journal is full
+edit_record* journal_push(edit_journal* journal) {
+    if (journal->count == EDIT_JOURNAL_DEPTH) {
+        edit_record* oldest = &journal->records[0];
+        for (int i = 0; i < oldest->count; i++) free(oldest->pieces[i].data);
+        free(oldest->pieces);
+        memmove(journal->records, journal->records + 1, sizeof(edit_record) * (EDIT_JOURNAL_DEPTH - 1));
+        journal->count--;
+    }
+    edit_record* record = &journal->records[journal->count++];
+    record->pieces = NULL;
+    record->count = 0;
+    record->overlapping = 0;
+    return record;
+}
+
+//journal (if asked) then apply an edit to the boxes of a clipped region
+void region_run(edit_job* job, region* boxes, int count, edit_journal* journal) {
+    job->boxes = boxes;
+    job->pieces = NULL;
+    if (journal != NULL) {
+        edit_record* record = journal_push(journal);
+        record->pieces = calloc(count, sizeof(edit_piece));
+        if (record->pieces == NULL) {
+            perror("Failed to allocate edit journal");
+            exit(EXIT_FAILURE);
+        }
+        record->count = count;
+        job->pieces = record->pieces;
+        parallel_for(count, edit_capture_job, job);
+    }
+    parallel_for(count, edit_apply_job, job);
+}
+
+//set every block in r to block
+void region_fill(char*** blocks, region r, char block, edit_journal* journal) {
+    r = region_clip(r);
+    if (region_volume(r) == 0) return;
+    region* boxes;
+    int count = region_split(r, &boxes);
+    edit_job job = { .blocks = blocks, .op = EDIT_FILL, .block = block };
+    region_run(&job, boxes, count, journal);
+    free(boxes);
+    notify_edit(blocks, r);
+}
+
+//turn every block of type from inside r into block
+void region_replace(char*** blocks, region r, char from, char block, edit_journal* journal) {
+    r = region_clip(r);
+    if (region_volume(r) == 0) return;
+    region* boxes;
+    int count = region_split(r, &boxes);
+    edit_job job = { .blocks = blocks, .op = EDIT_REPLACE, .block = block, .from = from };
+    region_run(&job, boxes, count, journal);
+    free(boxes);
+    notify_edit(blocks, r);
+}
+
+//copy the blocks of src so its min corner lands on (x, y, z). with move set the source
+//is cleared to air first, so overlapping moves behave like a cut and paste
+void region_clone(char*** blocks, region src, int x, int y, int z, int move, edit_journal* journal) {
+    int dx = x - src.x0, dy = y - src.y0, dz = z - src.z0;
+    src = region_clip(src);
+    region dst = { src.x0 + dx, src.y0 + dy, src.z0 + dz, src.x1 + dx, src.y1 + dy, src.z1 + dz };
+    dst = region_clip(dst);
+    if (region_volume(src) == 0) return;
+
+    char* source = malloc(region_volume(src));
+    if (source == NULL) {
+        perror("Failed to allocate clone buffer");
+        exit(EXIT_FAILURE);
+    }
+    region_gather(blocks, src, source);
+
+    // journal source and destination together so a move is undone in one step
+    region* src_boxes = NULL;
+    region* dst_boxes = NULL;
+    int src_count = move ? region_split(src, &src_boxes) : 0;
+    int dst_count = region_volume(dst) ? region_split(dst, &dst_boxes) : 0;
+    region* boxes = malloc(sizeof(region) * (src_count + dst_count + 1));
+    if (boxes == NULL) {
+        perror("Failed to allocate edit jobs");
+        exit(EXIT_FAILURE);
+    }
+    if (src_count) memcpy(boxes, src_boxes, sizeof(region) * src_count);
+    if (dst_count) memcpy(boxes + src_count, dst_boxes, sizeof(region) * dst_count);
+
+    if (journal != NULL) {
+        edit_record* record = journal_push(journal);
+        record->pieces = calloc(src_count + dst_count + 1, sizeof(edit_piece));
+        if (record->pieces == NULL) {
+            perror("Failed to allocate edit journal");
+            exit(EXIT_FAILURE);
+        }
+        record->count = src_count + dst_count;
+        record->overlapping = move;
+        edit_job capture = { .blocks = blocks, .boxes = boxes, .pieces = record->pieces };
+        parallel_for(record->count, edit_capture_job, &capture);
+    }
+
+    edit_job clear = { .blocks = blocks, .boxes = src_boxes, .op = EDIT_FILL, .block = ' ' };
+    parallel_for(src_count, edit_apply_job, &clear);
+    edit_job paste = { .blocks = blocks, .boxes = dst_boxes, .op = EDIT_CLONE,
+        .source = source, .src = src, .dx = dx, .dy = dy, .dz = dz };
+    parallel_for(dst_count, edit_apply_job, &paste);
+
+    free(boxes);
+    free(src_boxes);
+    free(dst_boxes);
+    free(source);
+    if (move) notify_edit(blocks, src);
+    notify_edit(blocks, dst);
+}
+
+//undo the most recent journaled edit, returns 0 if there is nothing to undo. a record whose
+//saved blocks don't decode to its boxes is dropped without touching the world, returning -1
+int region_undo(char*** blocks, edit_journal* journal) {
+    if (journal->count == 0) return 0;
+    edit_record* record = &journal->records[--journal->count];
+    region* boxes = malloc(sizeof(region) * (record->count + 1));
+    char** restored = calloc(record->count + 1, sizeof(char*));
+    if (boxes == NULL || restored == NULL) {
+        perror("Failed to allocate edit jobs");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < record->count; i++) boxes[i] = record->pieces[i].box;
+    edit_job job = { .blocks = blocks, .boxes = boxes, .pieces = record->pieces, .op = EDIT_RESTORE,
+        .restored = restored };
+    // decode every piece before changing anything, so a damaged one can't leave half an undo
+    parallel_for(record->count, edit_decode_job, &job);
+    int intact = 1;
+    for (int i = 0; i < record->count; i++) intact &= restored[i] != NULL;
+    if (!intact) {
+        for (int i = 0; i < record->count; i++) {
+            free(restored[i]);
+            free(record->pieces[i].data);
+        }
+        free(record->pieces);
+        free(restored);
+        free(boxes);
+        return -1;
+    }
+    if (record->overlapping) {
+        // every piece was captured before the edit, so overlapping cells hold the same bytes
+        for (int i = 0; i < record->count; i++) edit_apply_job(&job, i);
+    }
+    else {
+        parallel_for(record->count, edit_apply_job, &job);
+    }
+    for (int i = 0; i < record->count; i++) notify_edit(blocks, boxes[i]);
+    for (int i = 0; i < record->count; i++) {
+        free(restored[i]);
+        free(record->pieces[i].data);
+    }
+    free(record->pieces);
+    free(restored);
+    free(boxes);
+    return 1;
+}
+
+//release every record in the journal
+void journal_clear(edit_journal* journal) {
+    while (journal->count > 0) {
+        edit_record* record = &journal->records[--journal->count];
+        for (int i = 0; i < record->count; i++) free(record->pieces[i].data);
+        free(record->pieces);
+    }
+}
+
+/*
+    falling blocks and fluids
+
+    sand and water are updated as a cellular automaton, but only cells that might move are
+    looked at. every chunk column keeps a bitmap of cells to update on the next tick; a cell
+    is marked when something next to it changes and forgotten once it stays put, so the cost
+    of a tick follows the number of moving cells and not the size of the world.
+
+    a tick runs the active chunks in four passes of a 2x2 checkerboard. a cell only ever
+    touches its direct neighbours, so chunks of the same colour never share a cell and can be
+    updated in parallel. cells are visited bottom up in a fixed order and sideways moves pick
+    their direction from the tick number and position, so the result doesn't depend on how
+    many threads ran the tick.
+
+    a tick updates at most SIM_TICK_BUDGET cells. chunks are handed their queued cells out of
+    it in order, starting after the last chunk the previous tick got to, until it runs out; the
+    chunk it runs out in keeps the rest of its cells and the chunks after it wait whole, so a
+    big flood is worked off a budget at a time and every chunk gets its turn.
+*/
+#define SIM_TICK_BUDGET 65536    // cell updates per tick, the rest carry over to the next tick
+
+typedef struct BlockSim {
+    int chunk_cells;          // CHUNK_SIZE * CHUNK_SIZE * Z_BLOCKS
+    int words;                // bitmap words per chunk
+    _Atomic uint64_t* next;   // cells to update next tick, one bitmap per chunk
+    uint64_t* current;        // cells being updated this tick
+    atomic_int* pending;      // per chunk: next has bits set
+    int* active;              // chunks with cells to update this tick
+    int active_count;
+    region* changed;          // per chunk: box of cells its update wrote to
+    int* budgets;             // per chunk: cells it may update this tick
+    int cursor;               // chunk the next tick starts handing out the budget at
+    uint32_t tick;
+    int ticking;              // ignore edit notifications caused by the tick itself
+    char*** blocks;
+    atomic_uint_fast64_t updates;
+    atomic_uint_fast64_t moves;
+} block_sim;
+
+int sim_falls(char c) {
+    return c == SAND || c == WATER;
+}
+
+//queue a cell for the next tick, safe to call from several workers at once
+void sim_mark(block_sim* sim, int x, int y, int z) {
+    if (x < 0 || x >= X_BLOCKS || y < 0 || y >= Y_BLOCKS || z < 0 || z >= Z_BLOCKS) return;
+    int chunk = (y >> CHUNK_SHIFT) * X_CHUNKS + (x >> CHUNK_SHIFT);
+    int cell = (z * CHUNK_SIZE + (y & (CHUNK_SIZE - 1))) * CHUNK_SIZE + (x & (CHUNK_SIZE - 1));
+    _Atomic uint64_t* word = &sim->next[(size_t)chunk * sim->words + (cell >> 6)];
+    uint64_t bit = (uint64_t)1 << (cell & 63);
+    if (!(atomic_load_explicit(word, memory_order_relaxed) & bit)) {
+        atomic_fetch_or_explicit(word, bit, memory_order_relaxed);
+        atomic_store_explicit(&sim->pending[chunk], 1, memory_order_relaxed);
+    }
+}
+
+//queue the 3x3x3 neighbourhood of a cell
+void sim_mark_around(block_sim* sim, int x, int y, int z) {
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                sim_mark(sim, x + dx, y + dy, z + dz);
+            }
+        }
+    }
+}
+
+//edit listener: wake every falling block in and around the edited box
+void sim_on_edit(void* ctx, char*** blocks, region changed) {
+    block_sim* sim = ctx;
+    if (sim->ticking) return;
+    region r = { changed.x0 - 1, changed.y0 - 1, changed.z0 - 1, changed.x1 + 1, changed.y1 + 1, changed.z1 + 1 };
+    r = region_clip(r);
+    for (int z = r.z0; z < r.z1; z++) {
+        for (int y = r.y0; y < r.y1; y++) {
+            for (int x = r.x0; x < r.x1; x++) {
+                if (sim_falls(blocks[z][y][x])) sim_mark(sim, x, y, z);
+            }
+        }
+    }
+}
+
+block_sim* init_sim(char*** blocks) {
+    block_sim* sim = calloc(1, sizeof(block_sim));
+    if (sim == NULL) {
+        perror("Failed to allocate simulation");
+        exit(EXIT_FAILURE);
+    }
+    int chunks = X_CHUNKS * Y_CHUNKS;
+    sim->chunk_cells = CHUNK_SIZE * CHUNK_SIZE * Z_BLOCKS;
+    sim->words = (sim->chunk_cells + 63) / 64;
+    sim->next = calloc((size_t)chunks * sim->words, sizeof(uint64_t));
+    sim->current = calloc((size_t)chunks * sim->words, sizeof(uint64_t));
+    sim->pending = calloc(chunks, sizeof(atomic_int));
+    sim->active = malloc(sizeof(int) * chunks);
+    sim->changed = malloc(sizeof(region) * chunks);
+    sim->budgets = malloc(sizeof(int) * chunks);
+    if (sim->next == NULL || sim->current == NULL || sim->pending == NULL
+        || sim->active == NULL || sim->changed == NULL || sim->budgets == NULL) {
+        perror("Failed to allocate simulation");
+        exit(EXIT_FAILURE);
+    }
+    sim->blocks = blocks;
+    region world = { 0, 0, 0, X_BLOCKS, Y_BLOCKS, Z_BLOCKS };
+    sim_on_edit(sim, blocks, world);
+    add_edit_listener(sim_on_edit, sim);
+    return sim;
+}
+
+void free_sim(block_sim* sim) {
+    remove_edit_listener(sim_on_edit, sim);
+    free(sim->next);
+    free(sim->current);
+    free(sim->pending);
+    free(sim->active);
+    free(sim->changed);
+    free(sim->budgets);
+    free(sim);
+}
+
+//swap two cells and wake everything around both of them
+void sim_move(block_sim* sim, region* changed, int x, int y, int z, int nx, int ny, int nz) {
+    char*** blocks = sim->blocks;
+    char c = blocks[z][y][x];
+    blocks[z][y][x] = blocks[nz][ny][nx];
+    blocks[nz][ny][nx] = c;
+    sim_mark_around(sim, x, y, z);
+    sim_mark_around(sim, nx, ny, nz);
+    // both the cell left behind and the one moved into changed
+    region moved = { x < nx ? x : nx, y < ny ? y : ny, z < nz ? z : nz,
+        (x > nx ? x : nx) + 1, (y > ny ? y : ny) + 1, (z > nz ? z : nz) + 1 };
+    if (moved.x0 < changed->x0) changed->x0 = moved.x0;
+    if (moved.y0 < changed->y0) changed->y0 = moved.y0;
+    if (moved.z0 < changed->z0) changed->z0 = moved.z0;
+    if (moved.x1 > changed->x1) changed->x1 = moved.x1;
+    if (moved.y1 > changed->y1) changed->y1 = moved.y1;
+    if (moved.z1 > changed->z1) changed->z1 = moved.z1;
+    atomic_fetch_add_explicit(&sim->moves, 1, memory_order_relaxed);
+}
+
+//apply the rules to one cell, returns 1 if it moved
+int sim_update_cell(block_sim* sim, region* changed, int x, int y, int z) {
+    static const int dirs[4][2] = { { 1, 0 }, { 0, 1 }, { -1, 0 }, { 0, -1 } };
+    char*** blocks = sim->blocks;
+    char c = blocks[z][y][x];
+    if (!sim_falls(c) || z == 0) return 0;
+
+    // fall straight down, sand also sinks through water
+    char below = blocks[z - 1][y][x];
+    if (below == ' ' || (c == SAND && below == WATER)) {
+        sim_move(sim, changed, x, y, z, x, y, z - 1);
+        return 1;
+    }
+
+    // sand slides off edges, water spreads when pushed from above or when it can drop
+    int pressed = c == WATER && z + 1 < Z_BLOCKS && blocks[z + 1][y][x] == WATER;
+    int first = (int)((sim->tick + (uint32_t)x * 3 + (uint32_t)y * 5) & 3);
+    for (int i = 0; i < 4; i++) {
+        int nx = x + dirs[(first + i) & 3][0];
+        int ny = y + dirs[(first + i) & 3][1];
+        if (nx < 0 || nx >= X_BLOCKS || ny < 0 || ny >= Y_BLOCKS || blocks[z][ny][nx] != ' ') continue;
+        char drop = blocks[z - 1][ny][nx];
+        if (c == SAND && (drop == ' ' || drop == WATER)) {
+            sim_move(sim, changed, x, y, z, nx, ny, z - 1);
+            return 1;
+        }
+        if (c == WATER && (pressed || drop == ' ')) {
+            sim_move(sim, changed, x, y, z, nx, ny, z);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// chunks of one checkerboard colour
+typedef struct SimPass {
+    block_sim* sim;
+    int* chunks;
+} sim_pass;
+
+//update the queued cells of one chunk, bottom up, within the chunk's budget
+void sim_chunk_job(void* ctx, int index) {
+    block_sim* sim = ((sim_pass*)ctx)->sim;
+    int chunk = ((sim_pass*)ctx)->chunks[index];
+    int cx = chunk % X_CHUNKS;
+    int cy = chunk / X_CHUNKS;
+    uint64_t* bits = &sim->current[(size_t)chunk * sim->words];
+    region* changed = &sim->changed[chunk];
+    region none = { X_BLOCKS, Y_BLOCKS, Z_BLOCKS, 0, 0, 0 };
+    *changed = none;
+    int budget = sim->budgets[chunk];
+    uint64_t updates = 0;
+
+    for (int w = 0; w < sim->words; w++) {
+        while (bits[w] != 0) {
+            int cell = w * 64 + __builtin_ctzll(bits[w]);
+            if (budget == 0) {
+                // out of budget, carry the rest of the chunk over to the next tick
+                int lx = cell & (CHUNK_SIZE - 1);
+                int ly = (cell >> CHUNK_SHIFT) & (CHUNK_SIZE - 1);
+                int z = cell >> (2 * CHUNK_SHIFT);
+                sim_mark(sim, (cx << CHUNK_SHIFT) + lx, (cy << CHUNK_SHIFT) + ly, z);
+                bits[w] &= bits[w] - 1;
+                continue;
+            }
+            bits[w] &= bits[w] - 1;
+            int x = (cx << CHUNK_SHIFT) + (cell & (CHUNK_SIZE - 1));
+            int y = (cy << CHUNK_SHIFT) + ((cell >> CHUNK_SHIFT) & (CHUNK_SIZE - 1));
+            int z = cell >> (2 * CHUNK_SHIFT);
+            if (x >= X_BLOCKS || y >= Y_BLOCKS) continue;
+            sim_update_cell(sim, changed, x, y, z);
+            budget--;
+            updates++;
+        }
+    }
+    atomic_fetch_add_explicit(&sim->updates, updates, memory_order_relaxed);
+}
+
+//advance the simulation by one tick
+void sim_tick(block_sim* sim) {
+    int chunks = X_CHUNKS * Y_CHUNKS;
+
+    // take this tick's work from the pending bitmaps, chunk by chunk from the cursor until
+    // the budget is handed out. chunks left pending are taken whole on a later tick
+    sim->active_count = 0;
+    int remaining = SIM_TICK_BUDGET;
+    int last = -1;
+    for (int k = 0; k < chunks && remaining > 0; k++) {
+        int c = (sim->cursor + k) % chunks;
+        if (!atomic_load_explicit(&sim->pending[c], memory_order_relaxed)) continue;
+        atomic_store_explicit(&sim->pending[c], 0, memory_order_relaxed);
+        int queued = 0;
+        for (int w = 0; w < sim->words; w++) {
+            uint64_t bits = atomic_exchange_explicit(&sim->next[(size_t)c * sim->words + w], 0, memory_order_relaxed);
+            sim->current[(size_t)c * sim->words + w] = bits;
+            queued += __builtin_popcountll(bits);
+        }
+        sim->budgets[c] = queued < remaining ? queued : remaining;
+        remaining -= sim->budgets[c];
+        sim->active[sim->active_count++] = c;
+        last = c;
+    }
+    if (sim->active_count == 0) return;
+    sim->cursor = (last + 1) % chunks;
+    sim->ticking = 1;
+
+    // four checkerboard passes, chunks of one colour are at least a chunk apart
+    int* phase = malloc(sizeof(int) * sim->active_count);
+    if (phase == NULL) {
+        perror("Failed to allocate simulation pass");
+        exit(EXIT_FAILURE);
+    }
+    for (int p = 0; p < 4; p++) {
+        int count = 0;
+        for (int i = 0; i < sim->active_count; i++) {
+            int c = sim->active[i];
+            if (((c % X_CHUNKS) & 1) == (p & 1) && ((c / X_CHUNKS) & 1) == (p >> 1)) {
+                phase[count++] = c;
+            }
+        }
+        sim_pass pass = { sim, phase };
+        parallel_for(count, sim_chunk_job, &pass);
+    }
+    free(phase);
+
+    // let the other subsystems know what moved, sim_on_edit ignores these
+    for (int i = 0; i < sim->active_count; i++) {
+        notify_edit(sim->blocks, sim->changed[sim->active[i]]);
+    }
+    sim->ticking = 0;
+    sim->tick++;
+}
+
+/*
+    scheduled block updates
+
+    blocks can ask for an update a number of ticks from now, and every tick a few random
+    blocks of each loaded chunk get a random update. pending updates live in a hierarchical
+    timing wheel per chunk column: four levels of 64 slots, each slot a linked list, so
+    scheduling and cancelling are O(1). a tick only looks at the one slot that is due, and
+    now and then moves a slot of a coarser level down, so millions of updates due later
+    cost nothing per tick. updates further off than the wheels reach wait in an overflow list.
+
+    a cell has at most one pending update, scheduling it again replaces the old one.
+
+    updates run in the same four checkerboard passes as the simulation. an update may read
+    and write blocks at most CHUNK_SIZE / 2 away horizontally, so chunks of one colour never
+    touch the same cells. updates it schedules are queued on its own chunk and filed into the
+    wheels once the tick is done.
+
+    moving a coarse slot down touches every update in it at once. each chunk's wheel runs
+    at its own offset from the world's tick, so the chunks do this on different ticks and
+    a world full of pending updates spreads the work out instead of stalling one tick.
+*/
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+#define WHEEL_OVERFLOW (WHEEL_LEVELS * WHEEL_SLOTS)   // list index of the overflow list
+#define RANDOM_TICKS_PER_CHUNK 2
+
+typedef struct TickEntry {
+    int32_t next, prev;           // in the list of a wheel slot, or the free list
+    int32_t list;                 // level * WHEEL_SLOTS + slot, WHEEL_OVERFLOW, or -1 if free
+    uint32_t due;
+    uint32_t generation;          // bumped on reuse so stale handles can't cancel it
+    uint16_t x, y, z;
+    char block;                   // the update is dropped if the block changed meanwhile
+} tick_entry;
+
+typedef struct TickRequest {
+    int x, y, z;
+    int delay;
+} tick_request;
+
+typedef struct TickWheel {
+    tick_entry* entries;
+    int capacity;
+    int free_head;
+    int count;                    // updates pending
+    int32_t heads[WHEEL_OVERFLOW + 1];
+    int32_t* pending;             // entry pending for each cell of the column or -1, made on first use
+    int loaded;
+    uint32_t offset;              // added to the world's tick to get the wheel's own time
+    region changed;               // blocks written by this chunk's updates this tick
+    tick_request* outbox;         // updates scheduled by this chunk's updates this tick
+    int outbox_count, outbox_capacity;
+    uint64_t ran;
+} tick_wheel;
+
+typedef struct TickScheduler {
+    tick_wheel* wheels;           // one per chunk column
+    char*** blocks;
+    uint32_t now;                 // the tick being run, or the next one between ticks
+    int ticking;                  // ignore edit notifications caused by the tick itself
+    atomic_uint_fast64_t updates;
+} tick_scheduler;
+
+typedef struct TickContext {
+    tick_scheduler* sched;
+    tick_wheel* wheel;
+    char*** blocks;
+    uint64_t rng;
+} tick_context;
+
+// chunk, low 20 bits of the entry's generation and its index, plus one so 0 is no update
+typedef uint64_t tick_handle;
+
+tick_handle tick_handle_of(int chunk, int index, uint32_t generation) {
+    return ((uint64_t)chunk << 44 | (uint64_t)(generation & 0xFFFFF) << 24 | (uint64_t)index) + 1;
+}
+
+void wheel_link(tick_wheel* wheel, int index, int list) {
+    tick_entry* e = &wheel->entries[index];
+    e->list = list;
+    e->prev = -1;
+    e->next = wheel->heads[list];
+    if (e->next >= 0) wheel->entries[e->next].prev = index;
+    wheel->heads[list] = index;
+}
+
+void wheel_unlink(tick_wheel* wheel, int index) {
+    tick_entry* e = &wheel->entries[index];
+    if (e->prev >= 0) wheel->entries[e->prev].next = e->next;
+    else wheel->heads[e->list] = e->next;
+    if (e->next >= 0) wheel->entries[e->next].prev = e->prev;
+}
+
+//file an entry under the level whose slots tell its due tick apart from now
+void wheel_file(tick_wheel* wheel, int index, uint32_t now) {
+    uint32_t due = wheel->entries[index].due;
+    uint32_t apart = due ^ now;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        if (apart >> (WHEEL_BITS * (level + 1)) == 0) {
+            wheel_link(wheel, index, level * WHEEL_SLOTS + ((due >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)));
+            return;
+        }
+    }
+    wheel_link(wheel, index, WHEEL_OVERFLOW);
+}
+
+//slot of a cell in the column's pending table
+int wheel_cell(int x, int y, int z) {
+    return (z * CHUNK_SIZE + (y & (CHUNK_SIZE - 1))) * CHUNK_SIZE + (x & (CHUNK_SIZE - 1));
+}
+
+//entry pending for a cell, or -1
+int wheel_pending(tick_wheel* wheel, int x, int y, int z) {
+    return wheel->pending != NULL ? wheel->pending[wheel_cell(x, y, z)] : -1;
+}
+
+void wheel_release(tick_wheel* wheel, int index) {
+    tick_entry* e = &wheel->entries[index];
+    wheel->pending[wheel_cell(e->x, e->y, e->z)] = -1;
+    e->list = -1;
+    e->generation++;
+    e->next = wheel->free_head;
+    wheel->free_head = index;
+    wheel->count--;
+}
+
+int wheel_insert(tick_wheel* wheel, int x, int y, int z, char block, uint32_t due, uint32_t now) {
+    if (wheel->pending == NULL) {
+        int cells = CHUNK_SIZE * CHUNK_SIZE * Z_BLOCKS;
+        wheel->pending = malloc(sizeof(int32_t) * cells);
+        if (wheel->pending == NULL) {
+            perror("Failed to allocate block updates");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < cells; i++) wheel->pending[i] = -1;
+    }
+    int old = wheel->pending[wheel_cell(x, y, z)];
+    if (old >= 0) {
+        wheel_unlink(wheel, old);
+        wheel_release(wheel, old);
+    }
+    if (wheel->free_head < 0) {
+        int grown = wheel->capacity ? wheel->capacity * 2 : 64;
+        tick_entry* entries = realloc(wheel->entries, sizeof(tick_entry) * grown);
+        if (entries == NULL) {
+            perror("Failed to allocate block updates");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = grown - 1; i >= wheel->capacity; i--) {
+            entries[i].list = -1;
+            entries[i].generation = 0;
+            entries[i].next = wheel->free_head;
+            wheel->free_head = i;
+        }
+        wheel->entries = entries;
+        wheel->capacity = grown;
+    }
+    int index = wheel->free_head;
+    tick_entry* e = &wheel->entries[index];
+    wheel->free_head = e->next;
+    e->due = due;
+    e->x = (uint16_t)x;
+    e->y = (uint16_t)y;
+    e->z = (uint16_t)z;
+    e->block = block;
+    wheel->count++;
+    wheel->pending[wheel_cell(x, y, z)] = index;
+    wheel_file(wheel, index, now);
+    return index;
+}
+
+//move the entries of one slot down to finer levels now that their time is closer
+void wheel_cascade(tick_wheel* wheel, int list, uint32_t now) {
+    int index = wheel->heads[list];
+    wheel->heads[list] = -1;
+    while (index >= 0) {
+        int next = wheel->entries[index].next;
+        wheel_file(wheel, index, now);
+        index = next;
+    }
+}
+
+void wheel_advance(tick_wheel* wheel, uint32_t now) {
+    // coarser levels first, so what they hand down can be handed further down
+    for (int level = WHEEL_LEVELS; level >= 1; level--) {
+        if (now & ((1u << (WHEEL_BITS * level)) - 1)) continue;
+        if (level == WHEEL_LEVELS) wheel_cascade(wheel, WHEEL_OVERFLOW, now);
+        else wheel_cascade(wheel, level * WHEEL_SLOTS + ((now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)), now);
+    }
+}
+
+int tick_chunk_of(int x, int y) {
+    return (y >> CHUNK_SHIFT) * X_CHUNKS + (x >> CHUNK_SHIFT);
+}
+
+/*
+    what block updates may do: read blocks and write them through tick_set, so the write
+    is reported to the edit listeners, and ask for another update with tick_schedule.
+*/
+char tick_get(tick_context* ctx, int x, int y, int z) {
+    if (x < 0 || x >= X_BLOCKS || y < 0 || y >= Y_BLOCKS || z < 0 || z >= Z_BLOCKS) return ' ';
+    return ctx->blocks[z][y][x];
+}
+
+void tick_set(tick_context* ctx, int x, int y, int z, char block) {
+    if (x < 0 || x >= X_BLOCKS || y < 0 || y >= Y_BLOCKS || z < 0 || z >= Z_BLOCKS) return;
+    ctx->blocks[z][y][x] = block;
+    region* changed = &ctx->wheel->changed;
+    if (x < changed->x0) changed->x0 = x;
+    if (y < changed->y0) changed->y0 = y;
+    if (z < changed->z0) changed->z0 = z;
+    if (x + 1 > changed->x1) changed->x1 = x + 1;
+    if (y + 1 > changed->y1) changed->y1 = y + 1;
+    if (z + 1 > changed->z1) changed->z1 = z + 1;
+}
+
+void tick_schedule(tick_context* ctx, int x, int y, int z, int delay) {
+    tick_wheel* wheel = ctx->wheel;
+    if (wheel->outbox_count == wheel->outbox_capacity) {
+        wheel->outbox_capacity = wheel->outbox_capacity ? wheel->outbox_capacity * 2 : 16;
+        wheel->outbox = realloc(wheel->outbox, sizeof(tick_request) * wheel->outbox_capacity);
+        if (wheel->outbox == NULL) {
+            perror("Failed to allocate block updates");
+            exit(EXIT_FAILURE);
+        }
+    }
+    tick_request request = { x, y, z, delay };
+    wheel->outbox[wheel->outbox_count++] = request;
+}
+
+//random number for random ticks, a pure function of the chunk and tick so runs repeat
+uint32_t tick_random(tick_context* ctx) {
+    ctx->rng ^= ctx->rng << 13;
+    ctx->rng ^= ctx->rng >> 7;
+    ctx->rng ^= ctx->rng << 17;
+    return (uint32_t)(ctx->rng >> 32);
+}
+
+/*
+    ask for the block at (x, y, z) to be updated delay ticks from now, with the on_tick of
+    whatever block is there now, in place of any update already pending for the cell.
+    returns a handle for cancel_tick, or 0 if the cell is outside the world or its chunk
+    isn't loaded. only for use between ticks.
+*/
+tick_handle schedule_tick(tick_scheduler* sched, int x, int y, int z, int delay) {
+    if (x < 0 || x >= X_BLOCKS || y < 0 || y >= Y_BLOCKS || z < 0 || z >= Z_BLOCKS) return 0;
+    int chunk = tick_chunk_of(x, y);
+    tick_wheel* wheel = &sched->wheels[chunk];
+    if (!wheel->loaded) return 0;
+    if (delay < 1) delay = 1;
+    // between ticks now is the tick that runs next, which is one tick from now
+    uint32_t now = sched->now + wheel->offset;
+    int index = wheel_insert(wheel, x, y, z, sched->blocks[z][y][x], now + delay - 1, now);
+    return tick_handle_of(chunk, index, wheel->entries[index].generation);
+}
+
+//drop a pending update, returns 0 if it already ran or was cancelled
+int cancel_tick(tick_scheduler* sched, tick_handle handle) {
+    if (handle == 0) return 0;
+    handle--;
+    int chunk = (int)(handle >> 44);
+    int index = (int)(handle & 0xFFFFFF);
+    uint32_t generation = (uint32_t)(handle >> 24) & 0xFFFFF;
+    if (chunk >= X_CHUNKS * Y_CHUNKS) return 0;
+    tick_wheel* wheel = &sched->wheels[chunk];
+    if (index >= wheel->capacity) return 0;
+    tick_entry* e = &wheel->entries[index];
+    if (e->list < 0 || (e->generation & 0xFFFFF) != generation) return 0;
+    wheel_unlink(wheel, index);
+    wheel_release(wheel, index);
+    return 1;
+}
+
+typedef struct TickPass {
+    tick_scheduler* sched;
+    int* chunks;
+} tick_pass;
+
+void tick_chunk_job(void* arg, int index) {
+    tick_scheduler* sched = ((tick_pass*)arg)->sched;
+    int chunk = ((tick_pass*)arg)->chunks[index];
+    tick_wheel* wheel = &sched->wheels[chunk];
+    tick_context ctx = { sched, wheel, sched->blocks,
+        ((uint64_t)chunk * 0x9E3779B97F4A7C15ull ^ (uint64_t)sched->now << 20) | 1 };
+    uint64_t ran = 0;
+
+    // scheduled updates due now
+    if (wheel->count > 0) {
+        uint32_t now = sched->now + wheel->offset;
+        wheel_advance(wheel, now);
+        int list = now & (WHEEL_SLOTS - 1);
+        int at = wheel->heads[list];
+        wheel->heads[list] = -1;
+        while (at >= 0) {
+            tick_entry* e = &wheel->entries[at];
+            int next = e->next;
+            int x = e->x, y = e->y, z = e->z;
+            char block = e->block;
+            wheel_release(wheel, at);
+            block_tick_fn fn = block_lut.on_tick[(unsigned char)block];
+            if (fn != NULL && sched->blocks[z][y][x] == block) {
+                fn(&ctx, x, y, z);
+                ran++;
+            }
+            at = next;
+        }
+    }
+
+    // random updates anywhere in the chunk column
+    int x0 = (chunk % X_CHUNKS) << CHUNK_SHIFT, y0 = (chunk / X_CHUNKS) << CHUNK_SHIFT;
+    for (int i = 0; i < RANDOM_TICKS_PER_CHUNK; i++) {
+        uint32_t r = tick_random(&ctx);
+        int x = x0 + (int)(r & (CHUNK_SIZE - 1));
+        int y = y0 + (int)((r >> CHUNK_SHIFT) & (CHUNK_SIZE - 1));
+        int z = (int)((r >> (2 * CHUNK_SHIFT)) % (uint32_t)Z_BLOCKS);
+        if (x >= X_BLOCKS || y >= Y_BLOCKS) continue;
+        block_tick_fn fn = block_lut.on_random_tick[(unsigned char)sched->blocks[z][y][x]];
+        if (fn != NULL) {
+            fn(&ctx, x, y, z);
+            ran++;
+        }
+    }
+    wheel->ran += ran;
+    atomic_fetch_add_explicit(&sched->updates, ran, memory_order_relaxed);
+}
+
+void scheduler_tick(tick_scheduler* sched) {
+    int chunks = X_CHUNKS * Y_CHUNKS;
+    region none = { X_BLOCKS, Y_BLOCKS, Z_BLOCKS, 0, 0, 0 };
+    int* phase = malloc(sizeof(int) * chunks);
+    if (phase == NULL) {
+        perror("Failed to allocate block update pass");
+        exit(EXIT_FAILURE);
+    }
+    sched->ticking = 1;
+    for (int c = 0; c < chunks; c++) {
+        sched->wheels[c].changed = none;
+    }
+    for (int p = 0; p < 4; p++) {
+        int count = 0;
+        for (int c = 0; c < chunks; c++) {
+            if (!sched->wheels[c].loaded) continue;
+            if (((c % X_CHUNKS) & 1) == (p & 1) && ((c / X_CHUNKS) & 1) == (p >> 1)) {
+                phase[count++] = c;
+            }
+        }
+        tick_pass pass = { sched, phase };
+        parallel_for(count, tick_chunk_job, &pass);
+    }
+    free(phase);
+
+    for (int c = 0; c < chunks; c++) {
+        notify_edit(sched->blocks, sched->wheels[c].changed);
+    }
+    sched->ticking = 0;
+    sched->now++;
+
+    // file what the updates asked for, now that no pass is running
+    for (int c = 0; c < chunks; c++) {
+        tick_wheel* wheel = &sched->wheels[c];
+        for (int i = 0; i < wheel->outbox_count; i++) {
+            tick_request* r = &wheel->outbox[i];
+            schedule_tick(sched, r->x, r->y, r->z, r->delay);
+        }
+        wheel->outbox_count = 0;
+    }
+}
+
+//edit listener: blocks that were just placed and want an update get one. the box may
+//cover blocks that didn't change, those keep the update they're already waiting for
+void scheduler_on_edit(void* ctx, char*** blocks, region changed) {
+    tick_scheduler* sched = ctx;
+    if (sched->ticking) return;
+    for (int z = changed.z0; z < changed.z1; z++) {
+        for (int y = changed.y0; y < changed.y1; y++) {
+            for (int x = changed.x0; x < changed.x1; x++) {
+                char block = blocks[z][y][x];
+                int delay = block_lut.tick_delay[(unsigned char)block];
+                if (delay <= 0) continue;
+                tick_wheel* wheel = &sched->wheels[tick_chunk_of(x, y)];
+                int pending = wheel_pending(wheel, x, y, z);
+                if (pending >= 0 && wheel->entries[pending].block == block) continue;
+                schedule_tick(sched, x, y, z, delay);
+            }
+        }
+    }
+}
+
+void wheel_reset(tick_wheel* wheel) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->free_head = -1;
+    for (int i = 0; i <= WHEEL_OVERFLOW; i++) wheel->heads[i] = -1;
+}
+
+//stop updating a chunk column and forget its pending updates
+void scheduler_unload_chunk(tick_scheduler* sched, int chunk) {
+    tick_wheel* wheel = &sched->wheels[chunk];
+    uint32_t offset = wheel->offset;
+    free(wheel->entries);
+    free(wheel->outbox);
+    free(wheel->pending);
+    wheel_reset(wheel);
+    wheel->offset = offset;
+}
+
+//start updating a chunk column, scheduling the blocks in it that want updates
+void scheduler_load_chunk(tick_scheduler* sched, int chunk) {
+    tick_wheel* wheel = &sched->wheels[chunk];
+    if (wheel->loaded) return;
+    wheel->loaded = 1;
+    int x0 = (chunk % X_CHUNKS) << CHUNK_SHIFT, y0 = (chunk / X_CHUNKS) << CHUNK_SHIFT;
+    region column = { x0, y0, 0, x0 + CHUNK_SIZE, y0 + CHUNK_SIZE, Z_BLOCKS };
+    scheduler_on_edit(sched, sched->blocks, region_clip(column));
+}
+
+tick_scheduler* init_scheduler(char*** blocks) {
+    tick_scheduler* sched = calloc(1, sizeof(tick_scheduler));
+    int chunks = X_CHUNKS * Y_CHUNKS;
+    if (sched != NULL) sched->wheels = malloc(sizeof(tick_wheel) * chunks);
+    if (sched == NULL || sched->wheels == NULL) {
+        perror("Failed to allocate block updates");
+        exit(EXIT_FAILURE);
+    }
+    sched->blocks = blocks;
+    for (int c = 0; c < chunks; c++) {
+        wheel_reset(&sched->wheels[c]);
+        // multiplying by an odd constant spreads the offsets over every level's period
+        sched->wheels[c].offset = (uint32_t)c * 0x9E3779B1u;
+        scheduler_load_chunk(sched, c);
+    }
+    add_edit_listener(scheduler_on_edit, sched);
+    return sched;
+}
+
+void free_scheduler(tick_scheduler* sched) {
+    remove_edit_listener(scheduler_on_edit, sched);
+    for (int c = 0; c < X_CHUNKS * Y_CHUNKS; c++) {
+        scheduler_unload_chunk(sched, c);
+    }
+    free(sched->wheels);
+    free(sched);
+}
+
+/*
+    plants, the blocks that use updates: a sapling grows into a tree some time after it's
+    planted, and leaves with no trunk near them wither away at random.
+*/
+#define SAPLING 'Y'
+#define WOOD '|'
+#define LEAVES '&'
+#define SAPLING_GROW_TICKS 150
+#define TREE_HEIGHT 3
+
+void sapling_grow(tick_context* ctx, int x, int y, int z) {
+    for (int dz = 1; dz <= TREE_HEIGHT; dz++) {
+        if (z + dz >= Z_BLOCKS || tick_get(ctx, x, y, z + dz) != ' ') {
+            // no room yet, try again later
+            tick_schedule(ctx, x, y, z, SAPLING_GROW_TICKS);
+            return;
+        }
+    }
+    for (int dz = 0; dz < TREE_HEIGHT; dz++) {
+        tick_set(ctx, x, y, z + dz, WOOD);
+    }
+    for (int dz = TREE_HEIGHT - 1; dz <= TREE_HEIGHT; dz++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                if (tick_get(ctx, x + dx, y + dy, z + dz) == ' ') tick_set(ctx, x + dx, y + dy, z + dz, LEAVES);
+            }
+        }
+    }
+}
+
+void leaves_wither(tick_context* ctx, int x, int y, int z) {
+    for (int dz = -2; dz <= 2; dz++) {
+        for (int dy = -2; dy <= 2; dy++) {
+            for (int dx = -2; dx <= 2; dx++) {
+                if (tick_get(ctx, x + dx, y + dy, z + dz) == WOOD) return;
+            }
+        }
+    }
+    tick_set(ctx, x, y, z, ' ');
+}
+
+void register_plant_types() {
+    int opaque = BLOCK_SOLID | BLOCK_OPAQUE | BLOCK_OUTLINED;
+    register_block_type((block_type){ .name = "sapling", .glyph = SAPLING, .flags = opaque, .colour = 32,
+        .tick_delay = SAPLING_GROW_TICKS, .on_tick = sapling_grow });
+    register_block_type((block_type){ .name = "wood", .glyph = WOOD, .flags = opaque, .colour = 31 });
+    register_block_type((block_type){ .name = "leaves", .glyph = LEAVES, .flags = opaque, .colour = 32,
+        .on_random_tick = leaves_wither });
+}
+
+int ao_solid(char*** blocks, int x, int y, int z) {
+    return x >= 0 && x < X_BLOCKS && y >= 0 && y < Y_BLOCKS && z >= 0 && z < Z_BLOCKS
+        && (block_lut.flags[(unsigned char)blocks[z][y][x]] & BLOCK_OPAQUE);
+}
+
+//occlusion of the four corners of one face, packed two bits per corner
+uint8_t ao_face(char*** blocks, int x, int y, int z, int face) {
+    static const int normals[6][3] = { { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+    static const int tangents[3][2][3] = {
+        { { 0, 1, 0 }, { 0, 0, 1 } },   // x faces: u along y, v along z
+        { { 1, 0, 0 }, { 0, 0, 1 } },   // y faces: u along x, v along z
+        { { 1, 0, 0 }, { 0, 1, 0 } },   // z faces: u along x, v along y
+    };
+    if (blocks[z][y][x] == ' ') return 0;
+    // the cell in front of the face, whose neighbours shade it
+    int ax = x + normals[face][0], ay = y + normals[face][1], az = z + normals[face][2];
+    const int* t1 = tangents[face / 2][0];
+    const int* t2 = tangents[face / 2][1];
+    uint8_t packed = 0;
+    for (int k = 0; k < 4; k++) {
+        int s1 = (k & 1) ? 1 : -1, s2 = (k & 2) ? 1 : -1;
+        int side1 = ao_solid(blocks, ax + s1 * t1[0], ay + s1 * t1[1], az + s1 * t1[2]);
+        int side2 = ao_solid(blocks, ax + s2 * t2[0], ay + s2 * t2[1], az + s2 * t2[2]);
+        int corner = ao_solid(blocks, ax + s1 * t1[0] + s2 * t2[0], ay + s1 * t1[1] + s2 * t2[1],
+            az + s1 * t1[2] + s2 * t2[2]);
+        int occlusion = side1 && side2 ? 3 : side1 + side2 + corner;
+        packed |= (uint8_t)(occlusion << (2 * k));
+    }
+    return packed;
+}
+
+typedef struct AoJob {
+    char*** blocks;
+    region box;
+} ao_job;
+
+void ao_plane_job(void* ctx, int index) {
+    ao_job* job = ctx;
+    int z = job->box.z0 + index;
+    for (int y = job->box.y0; y < job->box.y1; y++) {
+        for (int x = job->box.x0; x < job->box.x1; x++) {
+            uint8_t* faces = &ao.faces[(((size_t)z * Y_BLOCKS + y) * X_BLOCKS + x) * 6];
+            for (int face = 0; face < 6; face++) {
+                faces[face] = ao_face(job->blocks, x, y, z, face);
+            }
+        }
+    }
+}
+
+//edit listener: faces up to one block away from an edit can see it
+void ao_on_edit(void* ctx, char*** blocks, region changed) {
+    (void)ctx;
+    region r = { changed.x0 - 1, changed.y0 - 1, changed.z0 - 1, changed.x1 + 1, changed.y1 + 1, changed.z1 + 1 };
+    ao_job job = { blocks, region_clip(r) };
+    parallel_for(job.box.z1 - job.box.z0, ao_plane_job, &job);
+}
+
+//compute the occlusion of the whole world and keep it up to date from now on
+void init_ao(char*** blocks) {
+    ao.blocks = blocks;
+    ao.faces = malloc((size_t)X_BLOCKS * Y_BLOCKS * Z_BLOCKS * 6);
+    if (ao.faces == NULL) {
+        perror("Failed to allocate ambient occlusion");
+        exit(EXIT_FAILURE);
+    }
+    region world = { 0, 0, 0, X_BLOCKS, Y_BLOCKS, Z_BLOCKS };
+    ao_on_edit(NULL, blocks, world);
+    add_edit_listener(ao_on_edit, NULL);
+}
+
+void free_ao() {
+    remove_edit_listener(ao_on_edit, NULL);
+    free(ao.faces);
+    ao.faces = NULL;
+    ao.blocks = NULL;
+}
+
+/*
+    world persistence
+
+    the world lives in two files: a snapshot of every block (PATH.snap) and a write-ahead
+    log of the boxes of blocks changed since (PATH.wal). an edit listener copies each changed
+    box into a pending batch, which is all the edits and ticks ever wait for. a background
+    thread takes the whole batch, encodes it, appends it with one write and makes it durable
+    with one fdatasync, so edits that arrive while a sync is running share the next one.
+
+    a checkpoint writes a new snapshot next to the old one, renames it into place and then
+    empties the log. the boxes pending when it was asked for are only dropped once the
+    snapshot holding them is durable; if it can't be written they go to the old log. both
+    files carry an epoch and a log is only replayed over the snapshot of the same epoch, so a
+    crash in between never replays old boxes over a newer world. every record has a checksum,
+    and replay stops at the first record a crash tore.
+*/
+#define SNAPSHOT_MAGIC "MCSNAP1"
+#define WAL_MAGIC "MCWAL01"
+#define WAL_CHECKPOINT_BYTES (8 << 20)   // log size that triggers a checkpoint
+
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint64_t epoch;
+    uint32_t x_blocks, y_blocks, z_blocks;
+    uint32_t size;                // rle encoded blocks that follow
+    uint32_t checksum;
+} snapshot_header;
+
+typedef struct WalHeader {
+    char magic[8];
+    uint64_t epoch;
+} wal_header;
+
+// one changed box, followed by its blocks run length encoded
+typedef struct WalRecord {
+    uint16_t x0, y0, z0, x1, y1, z1;
+    uint32_t size;
+    uint32_t checksum;            // over the box and the encoded blocks
+} wal_record;
+
+// changed boxes waiting to be written, each a region followed by its raw blocks
+typedef struct WalBatch {
+    uint8_t* data;
+    size_t size, capacity;
+    int count;
+} wal_batch;
+
+typedef struct WorldLog {
+    char* snapshot_path;
+    char* wal_path;
+    int fd;
+    uint64_t epoch;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int running;
+    wal_batch pending;            // filled by the edit listener
+    wal_batch writing;            // being written by the thread
+    char* checkpoint;             // copy of the world to checkpoint, NULL if none asked for
+    size_t covered;               // bytes of pending already held by that copy
+    int checkpointing;            // the thread is writing a checkpoint
+    atomic_uint_fast64_t log_bytes;
+    uint8_t* packed;              // encoding buffer of the thread
+    size_t packed_capacity;
+    uint64_t records, syncs, checkpoints;
+} world_log;
+
+uint32_t fnv1a(uint32_t hash, const void* data, size_t size) {
+    const uint8_t* p = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+uint32_t wal_record_checksum(wal_record record, const uint8_t* payload) {
+    record.checksum = 0;
+    return fnv1a(fnv1a(2166136261u, &record, sizeof(record)), payload, record.size);
+}
+
+void* grow_buffer(void* data, size_t* capacity, size_t needed) {
+    if (needed <= *capacity) return data;
+    size_t grown = *capacity ? *capacity : 4096;
+    while (grown < needed) grown *= 2;
+    data = realloc(data, grown);
+    if (data == NULL) {
+        perror("Failed to grow world log buffer");
+        exit(EXIT_FAILURE);
+    }
+    *capacity = grown;
+    return data;
+}
+
+//write all of size bytes, returns 0 on failure
+int write_all(int fd, const void* data, size_t size) {
+    const uint8_t* p = data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        size -= n;
+    }
+    return 1;
+}
+
+//copy the blocks of r into the block slab
+void region_scatter(char*** blocks, region b, const char* in) {
+    int w = b.x1 - b.x0;
+    for (int z = b.z0; z < b.z1; z++) {
+        for (int y = b.y0; y < b.y1; y++) {
+            memcpy(&blocks[z][y][b.x0], in, w);
+            in += w;
+        }
+    }
+}
+
+//make a rename durable by syncing the directory holding path
+void sync_parent_dir(const char* path) {
+    const char* slash = strrchr(path, '/');
+    char dir[4096] = ".";
+    if (slash != NULL && (size_t)(slash - path) < sizeof(dir)) {
+        memcpy(dir, path, slash - path);
+        dir[slash == path ? 1 : slash - path] = '\0';
+    }
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+//write world (a copy of the block slab) as the snapshot of a new epoch and empty the log,
+//returns 0 if the snapshot couldn't be made durable
+int wal_write_checkpoint(world_log* wal, const char* world) {
+    size_t n = (size_t)X_BLOCKS * Y_BLOCKS * Z_BLOCKS;
+    wal->packed = grow_buffer(wal->packed, &wal->packed_capacity, n + n / 128 + 1);
+    snapshot_header header = { SNAPSHOT_MAGIC, wal->epoch + 1, X_BLOCKS, Y_BLOCKS, Z_BLOCKS, 0, 0 };
+    header.size = (uint32_t)rle_encode(world, n, wal->packed);
+    header.checksum = fnv1a(2166136261u, wal->packed, header.size);
+
+    size_t length = strlen(wal->snapshot_path);
+    char* temp = malloc(length + 5);
+    if (temp == NULL) {
+        perror("Failed to allocate snapshot path");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(temp, wal->snapshot_path, length);
+    memcpy(temp + length, ".tmp", 5);
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int written = fd >= 0 && write_all(fd, &header, sizeof(header))
+        && write_all(fd, wal->packed, header.size) && fsync(fd) == 0;
+    if (fd >= 0) close(fd);
+    if (!written || rename(temp, wal->snapshot_path) != 0) {
+        // the old snapshot and log are still intact, carry on appending to them
+        perror("Failed to write world snapshot");
+        unlink(temp);
+        free(temp);
+        return 0;
+    }
+    free(temp);
+    sync_parent_dir(wal->snapshot_path);
+
+    // from here on the old log is stale whatever happens to the rest of the checkpoint
+    wal->epoch++;
+    wal_header log_header = { WAL_MAGIC, wal->epoch };
+    if (ftruncate(wal->fd, 0) != 0 || !write_all(wal->fd, &log_header, sizeof(log_header))
+        || fdatasync(wal->fd) != 0) {
+        perror("Failed to reset world log");
+    }
+    atomic_store(&wal->log_bytes, sizeof(log_header));
+    wal->checkpoints++;
+    return 1;
+}
+
+//encode and append the boxes of a batch from offset at on, then make them durable with one sync
+void wal_write_batch(world_log* wal, wal_batch* batch, size_t at) {
+    size_t out = 0;
+    int count = 0;
+    while (at < batch->size) {
+        region r;
+        memcpy(&r, batch->data + at, sizeof(r));
+        at += sizeof(r);
+        size_t n = region_volume(r);
+        wal->packed = grow_buffer(wal->packed, &wal->packed_capacity, out + sizeof(wal_record) + n + n / 128 + 1);
+        wal_record record = { r.x0, r.y0, r.z0, r.x1, r.y1, r.z1, 0, 0 };
+        uint8_t* payload = wal->packed + out + sizeof(record);
+        record.size = (uint32_t)rle_encode((const char*)batch->data + at, n, payload);
+        record.checksum = wal_record_checksum(record, payload);
+        memcpy(wal->packed + out, &record, sizeof(record));
+        out += sizeof(record) + record.size;
+        at += n;
+        count++;
+    }
+    if (out == 0) return;
+    if (!write_all(wal->fd, wal->packed, out) || fdatasync(wal->fd) != 0) {
+        perror("Failed to append to world log");
+        return;
+    }
+    atomic_fetch_add(&wal->log_bytes, out);
+    wal->records += count;
+    wal->syncs++;
+}
+
+void* wal_thread(void* arg) {
+    world_log* wal = arg;
+    pthread_mutex_lock(&wal->lock);
+    for (;;) {
+        while (wal->running && wal->pending.size == 0 && wal->checkpoint == NULL) {
+            pthread_cond_wait(&wal->wake, &wal->lock);
+        }
+        if (wal->pending.size == 0 && wal->checkpoint == NULL) break;
+        // take everything that queued up while the last write was syncing
+        wal_batch batch = wal->pending;
+        wal->pending = wal->writing;
+        wal->pending.size = 0;
+        wal->pending.count = 0;
+        char* checkpoint = wal->checkpoint;
+        size_t covered = wal->covered;
+        wal->checkpoint = NULL;
+        wal->covered = 0;
+        wal->checkpointing = checkpoint != NULL;
+        pthread_mutex_unlock(&wal->lock);
+
+        // boxes queued after a checkpoint was asked for are newer than it, so they go
+        // into the log that follows it. the ones it holds are skipped only if it stuck
+        size_t from = 0;
+        if (checkpoint != NULL) {
+            if (wal_write_checkpoint(wal, checkpoint)) from = covered;
+            free(checkpoint);
+        }
+        wal_write_batch(wal, &batch, from);
+
+        pthread_mutex_lock(&wal->lock);
+        wal->writing = batch;
+        wal->checkpointing = 0;
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return NULL;
+}
+
+//edit listener: queue a copy of the changed blocks for the log
+void wal_on_edit(void* ctx, char*** blocks, region changed) {
+    world_log* wal = ctx;
+    size_t n = region_volume(changed);
+    pthread_mutex_lock(&wal->lock);
+    wal_batch* batch = &wal->pending;
+    batch->data = grow_buffer(batch->data, &batch->capacity, batch->size + sizeof(region) + n);
+    memcpy(batch->data + batch->size, &changed, sizeof(region));
+    region_gather(blocks, changed, (char*)batch->data + batch->size + sizeof(region));
+    batch->size += sizeof(region) + n;
+    batch->count++;
+    pthread_cond_signal(&wal->wake);
+    pthread_mutex_unlock(&wal->lock);
+}
+
+//hand a copy of the world to the log thread to checkpoint. the boxes still pending
+//are part of that copy, so they only reach the old log if the checkpoint fails
+void wal_checkpoint(world_log* wal, char*** blocks) {
+    size_t n = (size_t)X_BLOCKS * Y_BLOCKS * Z_BLOCKS;
+    char* world = malloc(n);
+    if (world == NULL) {
+        perror("Failed to allocate world snapshot");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(world, blocks[0][0], n);
+    pthread_mutex_lock(&wal->lock);
+    free(wal->checkpoint);
+    wal->checkpoint = world;
+    wal->covered = wal->pending.size;
+    pthread_cond_signal(&wal->wake);
+    pthread_mutex_unlock(&wal->lock);
+}
+
+//checkpoint once the log has grown large, called between frames. the log only shrinks
+//when a checkpoint succeeds, so a failed one is asked for again
+void wal_maybe_checkpoint(world_log* wal, char*** blocks) {
+    if (atomic_load(&wal->log_bytes) <= WAL_CHECKPOINT_BYTES) return;
+    pthread_mutex_lock(&wal->lock);
+    int busy = wal->checkpoint != NULL || wal->checkpointing;
+    pthread_mutex_unlock(&wal->lock);
+    if (!busy) wal_checkpoint(wal, blocks);
+}
+
+//load the snapshot at path into blocks, returns its epoch or 0 if there is none
+uint64_t wal_load_snapshot(const char* path, char*** blocks, int* failed) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return 0;
+    snapshot_header header;
+    size_t n = (size_t)X_BLOCKS * Y_BLOCKS * Z_BLOCKS;
+    uint64_t epoch = 0;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, SNAPSHOT_MAGIC, 8) != 0) {
+        fprintf(stderr, "%s is not a world snapshot\n", path);
+    }
+    else if (header.x_blocks != (uint32_t)X_BLOCKS || header.y_blocks != (uint32_t)Y_BLOCKS
+        || header.z_blocks != (uint32_t)Z_BLOCKS) {
+        fprintf(stderr, "%s holds a %ux%ux%u world, the config asks for %dx%dx%d\n", path,
+            header.x_blocks, header.y_blocks, header.z_blocks, X_BLOCKS, Y_BLOCKS, Z_BLOCKS);
+    }
+    else {
+        uint8_t* payload = malloc(header.size + 1);
+        if (payload == NULL) {
+            perror("Failed to allocate world snapshot");
+            exit(EXIT_FAILURE);
+        }
+        if (fread(payload, 1, header.size, file) == header.size
+            && fnv1a(2166136261u, payload, header.size) == header.checksum
+            && rle_decode(payload, header.size, blocks[0][0], n, 0)) {
+            epoch = header.epoch;
+        }
+        else {
+            fprintf(stderr, "%s is damaged\n", path);
+        }
+        free(payload);
+    }
+    fclose(file);
+    *failed = epoch == 0;
+    return epoch;
+}
+
+//apply the log records of the given epoch, returns the offset after the last good record
+off_t wal_replay(int fd, uint64_t epoch, char*** blocks) {
+    wal_header header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, WAL_MAGIC, 8) != 0
+        || header.epoch != epoch) {
+        return 0;
+    }
+    off_t at = sizeof(header);
+    uint8_t* payload = NULL;
+    size_t payload_capacity = 0;
+    char* raw = NULL;
+    size_t raw_capacity = 0;
+    wal_record record;
+    while (pread(fd, &record, sizeof(record), at) == sizeof(record)) {
+        region r = { record.x0, record.y0, record.z0, record.x1, record.y1, record.z1 };
+        size_t n = region_volume(r);
+        if (n == 0 || r.x1 > X_BLOCKS || r.y1 > Y_BLOCKS || r.z1 > Z_BLOCKS) break;
+        payload = grow_buffer(payload, &payload_capacity, record.size + 1);
+        raw = grow_buffer(raw, &raw_capacity, n);
+        if (pread(fd, payload, record.size, at + sizeof(record)) != (ssize_t)record.size
+            || wal_record_checksum(record, payload) != record.checksum
+            || !rle_decode(payload, record.size, raw, n, 0)) {
+            break;
+        }
+        region_scatter(blocks, r, raw);
+        at += sizeof(record) + record.size;
+    }
+    free(payload);
+    free(raw);
+    return at;
+}
+
+/*
+    restore the world saved at path (path.snap and path.wal) into blocks and log every
+    edit from now on. a path without a saved world starts from blocks as they are.
+    returns NULL, leaving the world unsaved, if the files can't be used.
+*/
+world_log* wal_open(const char* path, char*** blocks) {
+    world_log* wal = calloc(1, sizeof(world_log));
+    if (wal == NULL) {
+        perror("Failed to allocate world log");
+        exit(EXIT_FAILURE);
+    }
+    size_t length = strlen(path);
+    wal->snapshot_path = malloc(length + 6);
+    wal->wal_path = malloc(length + 5);
+    if (wal->snapshot_path == NULL || wal->wal_path == NULL) {
+        perror("Failed to allocate world log");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(wal->snapshot_path, length + 6, "%s.snap", path);
+    snprintf(wal->wal_path, length + 5, "%s.wal", path);
+
+    int failed = 0;
+    wal->epoch = wal_load_snapshot(wal->snapshot_path, blocks, &failed);
+    wal->fd = failed ? -1 : open(wal->wal_path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (wal->fd < 0) {
+        if (!failed) perror("Failed to open world log");
+        free(wal->snapshot_path);
+        free(wal->wal_path);
+        free(wal);
+        return NULL;
+    }
+    if (wal->epoch != 0) {
+        // cut off a record torn by a crash so new records follow the last good one
+        off_t end = wal_replay(wal->fd, wal->epoch, blocks);
+        if (end == 0) {
+            wal_header header = { WAL_MAGIC, wal->epoch };
+            end = sizeof(header);
+            if (ftruncate(wal->fd, 0) != 0 || !write_all(wal->fd, &header, sizeof(header))) {
+                perror("Failed to reset world log");
+            }
+        }
+        else if (ftruncate(wal->fd, end) != 0) {
+            perror("Failed to trim world log");
+        }
+        atomic_store(&wal->log_bytes, end);
+    }
+
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->wake, NULL);
+    wal->running = 1;
+    if (pthread_create(&wal->thread, NULL, wal_thread, wal) != 0) {
+        perror("Failed to start world log thread");
+        exit(EXIT_FAILURE);
+    }
+    // a new world gets its first snapshot, so the log always has one to start from
+    if (wal->epoch == 0) wal_checkpoint(wal, blocks);
+    add_edit_listener(wal_on_edit, wal);
+    return wal;
+}
+
+//checkpoint the world one last time and stop logging
+void wal_close(world_log* wal, char*** blocks) {
+    remove_edit_listener(wal_on_edit, wal);
+    wal_checkpoint(wal, blocks);
+    pthread_mutex_lock(&wal->lock);
+    wal->running = 0;
+    pthread_cond_signal(&wal->wake);
+    pthread_mutex_unlock(&wal->lock);
+    pthread_join(wal->thread, NULL);
+
+    printf("\nsaved world: %llu edits in %llu syncs, %llu checkpoints\n",
+        (unsigned long long)wal->records, (unsigned long long)wal->syncs,
+        (unsigned long long)wal->checkpoints);
+
+    close(wal->fd);
+    pthread_mutex_destroy(&wal->lock);
+    pthread_cond_destroy(&wal->wake);
+    free(wal->pending.data);
+    free(wal->writing.data);
+    free(wal->checkpoint);
+    free(wal->packed);
+    free(wal->snapshot_path);
+    free(wal->wal_path);
+    free(wal);
+}
+
+/*
+    pathfinding
+
+    walkers stand in a free cell with a free cell above it and something solid (not water)
+    below, and move one block sideways per step, stepping up or down at most one block.
+
+    paths are found on two levels. every border between two chunk columns is scanned for
+    places a walker can cross it, and each run of neighbouring crossings becomes one portal.
+    the portals' ends are the nodes of an abstract graph: within a chunk, nodes are joined by
+    their walking distance (found by a breadth first search over the chunk and cached), and
+    across a border the two ends of a portal are one step apart. a query searches the
+    abstract graph with A* and then fills in the steps between nodes chunk by chunk.
+
+    edits only mark the chunks they touch. before the next batch of queries the borders of
+    those chunks are rescanned, and only chunks whose portals or interior changed have their
+    distances recomputed. every worker has its own search buffers, reused from one query to
+    the next, so a batch doesn't allocate once the buffers have grown to size.
+*/
+#define PATH_INF 0xFFFF
+
+typedef struct BlockPos {
+    int x, y, z;
+} block_pos;
+
+// a crossing between two chunks, a lies in the chunk with the lower coordinate
+typedef struct Portal {
+    block_pos a;
+    block_pos b;
+} portal;
+
+typedef struct Border {
+    portal* portals;
+    int count;
+    int cap;
+} border;
+
+// nodes of a chunk are the portal ends on its four sides, in side order -x, +x, -y, +y
+typedef struct ChunkGraph {
+    int borders[4];           // border on each side, -1 at the edge of the world
+    int start[5];             // first node of each side, start[4] is the node count
+    uint16_t* cost;           // walking distance between every pair of nodes
+    int cost_cap;
+    int stale;                // cost needs to be recomputed
+} chunk_graph;
+
+typedef struct HeapEntry {
+    int f;
+    int node;
+} heap_entry;
+
+// search buffers of one worker
+typedef struct PathContext {
+    uint32_t* seen;           // chunk search: stamp of the search that reached a cell
+    uint32_t stamp;
+    int* parent;
+    int* queue;
+    uint16_t* dist;
+    uint16_t* start_dist;     // distances from the query start to the nodes of its chunk
+    uint16_t* goal_dist;      // distances from the nodes of the goal chunk to the goal
+    int dist_cap;
+    uint32_t* opened;         // abstract search: stamp of the search that opened a node
+    uint32_t search;
+    int* g;
+    int* from;
+    int node_cap;
+    heap_entry* heap;
+    int heap_count;
+    int heap_cap;
+    int* route;               // abstract nodes of the current path
+} path_context;
+
+typedef struct PathService {
+    char*** blocks;
+    border* borders;          // borders along x first, then borders along y
+    int x_borders;
+    int border_count;
+    chunk_graph* chunks;
+    int* node_base;           // id of each chunk's first node in the abstract graph
+    int* node_chunk;          // chunk of every abstract node
+    block_pos* node_pos;      // cell of every abstract node
+    int* node_partner;        // node at the other end of every node's portal
+    int node_total;
+    int node_chunk_cap;
+    unsigned char* dirty;     // chunks touched by edits since the last rebuild
+    int any_dirty;
+    path_context* contexts;
+    int context_count;
+} path_service;
+
+typedef struct PathQuery {
+    block_pos start;
+    block_pos goal;
+    block_pos* steps;         // caller owned, receives the path from start to goal
+    int max_steps;
+    int length;               // steps written, 0 if there's no path or it didn't fit
+} path_query;
+
+int walk_clear(char*** blocks, int x, int y, int z) {
+    return z >= Z_BLOCKS || !(block_lut.flags[(unsigned char)blocks[z][y][x]] & BLOCK_SOLID);
+}
+
+//can a walker stand in this cell
+int walk_standable(char*** blocks, int x, int y, int z) {
+    if (x < 0 || x >= X_BLOCKS || y < 0 || y >= Y_BLOCKS || z < 1 || z >= Z_BLOCKS) return 0;
+    char below = blocks[z - 1][y][x];
+    return (block_lut.flags[(unsigned char)below] & BLOCK_SOLID) && walk_clear(blocks, x, y, z)
+        && walk_clear(blocks, x, y, z + 1);
+}
+
+//height a walker standing at (x, y, z) ends up at after stepping to column (nx, ny), or -1
+int walk_step(char*** blocks, int x, int y, int z, int nx, int ny) {
+    if (nx < 0 || nx >= X_BLOCKS || ny < 0 || ny >= Y_BLOCKS) return -1;
+    if (walk_standable(blocks, nx, ny, z)) return z;
+    if (walk_standable(blocks, nx, ny, z + 1) && walk_clear(blocks, x, y, z + 2)) return z + 1;
+    if (walk_standable(blocks, nx, ny, z - 1) && walk_clear(blocks, nx, ny, z + 1)) return z - 1;
+    return -1;
+}
+
+int chunk_of(int x, int y) {
+    return (y >> CHUNK_SHIFT) * X_CHUNKS + (x >> CHUNK_SHIFT);
+}
+
+//rescan the crossings of one border, returns 1 if its portals changed
+int path_scan_border(path_service* ps, int id) {
+    char*** blocks = ps->blocks;
+    border* b = &ps->borders[id];
+    int along_x = id < ps->x_borders;
+    int chunk = along_x ? id / (X_CHUNKS - 1) * X_CHUNKS + id % (X_CHUNKS - 1) : id - ps->x_borders;
+    int cx = chunk % X_CHUNKS, cy = chunk / X_CHUNKS;
+    // the low side's last row or column, and the range along the border
+    int edge = along_x ? ((cx + 1) << CHUNK_SHIFT) - 1 : ((cy + 1) << CHUNK_SHIFT) - 1;
+    int lo = along_x ? cy << CHUNK_SHIFT : cx << CHUNK_SHIFT;
+    int hi = lo + CHUNK_SIZE;
+    if (hi > (along_x ? Y_BLOCKS : X_BLOCKS)) hi = along_x ? Y_BLOCKS : X_BLOCKS;
+
+    int old_count = b->count;
+    int count = 0;
+    int changed = 0;
+    for (int z = 0; z < Z_BLOCKS; z++) {
+        int run = -1, run_z = 0;
+        for (int t = lo; t <= hi; t++) {
+            int nz = -1;
+            if (t < hi) {
+                int x = along_x ? edge : t, y = along_x ? t : edge;
+                if (walk_standable(blocks, x, y, z)) {
+                    nz = walk_step(blocks, x, y, z, along_x ? x + 1 : x, along_x ? y : y + 1);
+                }
+            }
+            if (run >= 0 && (nz != run_z || t == hi)) {
+                // close the run, its portal sits in the middle
+                int m = (run + t - 1) / 2;
+                portal p;
+                p.a.x = along_x ? edge : m;
+                p.a.y = along_x ? m : edge;
+                p.a.z = z;
+                p.b.x = along_x ? edge + 1 : m;
+                p.b.y = along_x ? m : edge + 1;
+                p.b.z = run_z;
+                if (count == b->cap) {
+                    b->cap = b->cap ? b->cap * 2 : 8;
+                    b->portals = realloc(b->portals, sizeof(portal) * b->cap);
+                    if (b->portals == NULL) {
+                        perror("Failed to allocate portals");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                if (count >= old_count || memcmp(&b->portals[count], &p, sizeof(p)) != 0) {
+                    changed = 1;
+                }
+                b->portals[count++] = p;
+                run = -1;
+            }
+            if (run < 0 && nz >= 0) {
+                run = t;
+                run_z = nz;
+            }
+        }
+    }
+    b->count = count;
+    return changed || count != old_count;
+}
+
+//position and abstract partner of node i of a chunk
+block_pos path_node_pos(path_service* ps, int chunk, int i, int* partner) {
+    chunk_graph* g = &ps->chunks[chunk];
+    int side = 0;
+    while (i >= g->start[side + 1]) side++;
+    portal* p = &ps->borders[g->borders[side]].portals[i - g->start[side]];
+    if (partner != NULL) {
+        int other = chunk + (side == 0 ? -1 : side == 1 ? 1 : side == 2 ? -X_CHUNKS : X_CHUNKS);
+        chunk_graph* og = &ps->chunks[other];
+        *partner = ps->node_base[other] + og->start[side ^ 1] + (i - g->start[side]);
+    }
+    return (side & 1) ? p->a : p->b;
+}
+
+//make sure a context's buffers can hold the current graph
+void path_context_reserve(path_service* ps, path_context* ctx) {
+    int chunk_cells = CHUNK_SIZE * CHUNK_SIZE * Z_BLOCKS;
+    if (ctx->seen == NULL) {
+        ctx->seen = calloc(chunk_cells, sizeof(uint32_t));
+        ctx->parent = malloc(sizeof(int) * chunk_cells);
+        ctx->queue = malloc(sizeof(int) * chunk_cells);
+        ctx->dist = malloc(sizeof(uint16_t) * chunk_cells);
+        if (ctx->seen == NULL || ctx->parent == NULL || ctx->queue == NULL || ctx->dist == NULL) {
+            perror("Failed to allocate path buffers");
+            exit(EXIT_FAILURE);
+        }
+    }
+    int nodes = ps->node_total + 2;
+    if (nodes > ctx->node_cap) {
+        ctx->node_cap = nodes * 2;
+        free(ctx->opened);
+        ctx->opened = calloc(ctx->node_cap, sizeof(uint32_t));
+        ctx->search = 0;
+        ctx->g = realloc(ctx->g, sizeof(int) * ctx->node_cap);
+        ctx->from = realloc(ctx->from, sizeof(int) * ctx->node_cap);
+        ctx->route = realloc(ctx->route, sizeof(int) * ctx->node_cap);
+        ctx->heap_cap = ctx->node_cap * 4;
+        ctx->heap = realloc(ctx->heap, sizeof(heap_entry) * ctx->heap_cap);
+        if (ctx->opened == NULL || ctx->g == NULL || ctx->from == NULL || ctx->route == NULL || ctx->heap == NULL) {
+            perror("Failed to allocate path buffers");
+            exit(EXIT_FAILURE);
+        }
+    }
+    int most = 0;
+    for (int c = 0; c < X_CHUNKS * Y_CHUNKS; c++) {
+        if (ps->chunks[c].start[4] > most) most = ps->chunks[c].start[4];
+    }
+    if (most > ctx->dist_cap) {
+        ctx->dist_cap = most * 2;
+        ctx->start_dist = realloc(ctx->start_dist, sizeof(uint16_t) * ctx->dist_cap);
+        ctx->goal_dist = realloc(ctx->goal_dist, sizeof(uint16_t) * ctx->dist_cap);
+        if (ctx->start_dist == NULL || ctx->goal_dist == NULL) {
+            perror("Failed to allocate path buffers");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+int chunk_cell_index(int chunk, block_pos p) {
+    int x0 = (chunk % X_CHUNKS) << CHUNK_SHIFT, y0 = (chunk / X_CHUNKS) << CHUNK_SHIFT;
+    return (p.z * CHUNK_SIZE + (p.y - y0)) * CHUNK_SIZE + (p.x - x0);
+}
+
+block_pos chunk_cell_pos(int chunk, int index) {
+    block_pos p;
+    p.x = ((chunk % X_CHUNKS) << CHUNK_SHIFT) + (index & (CHUNK_SIZE - 1));
+    p.y = ((chunk / X_CHUNKS) << CHUNK_SHIFT) + ((index >> CHUNK_SHIFT) & (CHUNK_SIZE - 1));
+    p.z = index >> (2 * CHUNK_SHIFT);
+    return p;
+}
+
+//breadth first search over the standable cells of one chunk, starting at from
+void path_chunk_search(path_service* ps, path_context* ctx, int chunk, block_pos from) {
+    static const int dirs[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+    int x0 = (chunk % X_CHUNKS) << CHUNK_SHIFT, y0 = (chunk / X_CHUNKS) << CHUNK_SHIFT;
+    ctx->stamp++;
+    int head = 0, tail = 0;
+    int s = chunk_cell_index(chunk, from);
+    ctx->seen[s] = ctx->stamp;
+    ctx->dist[s] = 0;
+    ctx->parent[s] = -1;
+    ctx->queue[tail++] = s;
+    while (head < tail) {
+        int i = ctx->queue[head++];
+        block_pos p = chunk_cell_pos(chunk, i);
+        for (int d = 0; d < 4; d++) {
+            int nx = p.x + dirs[d][0], ny = p.y + dirs[d][1];
+            if (nx < x0 || nx >= x0 + CHUNK_SIZE || ny < y0 || ny >= y0 + CHUNK_SIZE) continue;
+            int nz = walk_step(ps->blocks, p.x, p.y, p.z, nx, ny);
+            if (nz < 0) continue;
+            block_pos n = { nx, ny, nz };
+            int j = chunk_cell_index(chunk, n);
+            if (ctx->seen[j] == ctx->stamp) continue;
+            ctx->seen[j] = ctx->stamp;
+            ctx->dist[j] = ctx->dist[i] + 1;
+            ctx->parent[j] = i;
+            ctx->queue[tail++] = j;
+        }
+    }
+}
+
+//distance found by the last chunk search, PATH_INF if it wasn't reached
+uint16_t path_chunk_dist(path_context* ctx, int chunk, block_pos p) {
+    int i = chunk_cell_index(chunk, p);
+    return ctx->seen[i] == ctx->stamp ? ctx->dist[i] : PATH_INF;
+}
+
+//recompute the walking distances between the nodes of a chunk
+void path_chunk_costs(path_service* ps, path_context* ctx, int chunk) {
+    chunk_graph* g = &ps->chunks[chunk];
+    int n = g->start[4];
+    if (n * n > g->cost_cap) {
+        g->cost_cap = n * n;
+        g->cost = realloc(g->cost, sizeof(uint16_t) * g->cost_cap);
+        if (g->cost == NULL) {
+            perror("Failed to allocate chunk costs");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        path_chunk_search(ps, ctx, chunk, ps->node_pos[ps->node_base[chunk] + i]);
+        for (int j = 0; j < n; j++) {
+            g->cost[i * n + j] = path_chunk_dist(ctx, chunk, ps->node_pos[ps->node_base[chunk] + j]);
+        }
+    }
+    g->stale = 0;
+}
+
+typedef struct PathBatch {
+    path_service* ps;
+    path_query* queries;
+    int count;
+    int* chunks;
+} path_batch;
+
+void path_costs_job(void* arg, int k) {
+    path_batch* batch = arg;
+    path_context* ctx = &batch->ps->contexts[k];
+    for (int i = k; i < batch->count; i += batch->ps->context_count) {
+        path_chunk_costs(batch->ps, ctx, batch->chunks[i]);
+    }
+}
+
+//bring the abstract graph up to date with the edits made since the last batch
+void path_rebuild(path_service* ps) {
+    if (!ps->any_dirty) return;
+    int chunks = X_CHUNKS * Y_CHUNKS;
+    for (int c = 0; c < chunks; c++) {
+        if (!ps->dirty[c]) continue;
+        ps->chunks[c].stale = 1;
+        for (int side = 0; side < 4; side++) {
+            int id = ps->chunks[c].borders[side];
+            if (id < 0 || !path_scan_border(ps, id)) continue;
+            // the chunk on the other side gains or loses nodes too
+            int other = c + (side == 0 ? -1 : side == 1 ? 1 : side == 2 ? -X_CHUNKS : X_CHUNKS);
+            ps->chunks[other].stale = 1;
+        }
+        ps->dirty[c] = 0;
+    }
+    ps->any_dirty = 0;
+
+    // lay the nodes out again
+    int total = 0;
+    for (int c = 0; c < chunks; c++) {
+        chunk_graph* g = &ps->chunks[c];
+        ps->node_base[c] = total;
+        for (int side = 0; side < 4; side++) {
+            g->start[side] = total - ps->node_base[c];
+            if (g->borders[side] >= 0) total += ps->borders[g->borders[side]].count;
+        }
+        g->start[4] = total - ps->node_base[c];
+    }
+    ps->node_total = total;
+    if (total > ps->node_chunk_cap) {
+        ps->node_chunk_cap = total * 2;
+        ps->node_chunk = realloc(ps->node_chunk, sizeof(int) * ps->node_chunk_cap);
+        ps->node_pos = realloc(ps->node_pos, sizeof(block_pos) * ps->node_chunk_cap);
+        ps->node_partner = realloc(ps->node_partner, sizeof(int) * ps->node_chunk_cap);
+        if (ps->node_chunk == NULL || ps->node_pos == NULL || ps->node_partner == NULL) {
+            perror("Failed to allocate path nodes");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int c = 0; c < chunks; c++) {
+        for (int i = 0; i < ps->chunks[c].start[4]; i++) {
+            int u = ps->node_base[c] + i;
+            ps->node_chunk[u] = c;
+            ps->node_pos[u] = path_node_pos(ps, c, i, &ps->node_partner[u]);
+        }
+    }
+    for (int k = 0; k < ps->context_count; k++) {
+        path_context_reserve(ps, &ps->contexts[k]);
+    }
+
+    // only chunks that changed need their distances again
+    int* stale = malloc(sizeof(int) * chunks);
+    if (stale == NULL) {
+        perror("Failed to allocate path rebuild");
+        exit(EXIT_FAILURE);
+    }
+    int count = 0;
+    for (int c = 0; c < chunks; c++) {
+        if (ps->chunks[c].stale) stale[count++] = c;
+    }
+    path_batch batch = { ps, NULL, count, stale };
+    parallel_for(ps->context_count < count ? ps->context_count : count, path_costs_job, &batch);
+    free(stale);
+}
+
+//edit listener: a block change can alter the crossings and walks of the chunks around it
+void path_on_edit(void* arg, char*** blocks, region changed) {
+    (void)blocks;
+    path_service* ps = arg;
+    region r = { changed.x0 - 1, changed.y0 - 1, changed.z0, changed.x1 + 1, changed.y1 + 1, changed.z1 };
+    r = region_clip(r);
+    for (int cy = r.y0 >> CHUNK_SHIFT; cy <= (r.y1 - 1) >> CHUNK_SHIFT; cy++) {
+        for (int cx = r.x0 >> CHUNK_SHIFT; cx <= (r.x1 - 1) >> CHUNK_SHIFT; cx++) {
+            ps->dirty[cy * X_CHUNKS + cx] = 1;
+        }
+    }
+    ps->any_dirty = 1;
+}
+
+path_service* init_path_service(char*** blocks) {
+    path_service* ps = calloc(1, sizeof(path_service));
+    if (ps == NULL) {
+        perror("Failed to allocate path service");
+        exit(EXIT_FAILURE);
+    }
+    int chunks = X_CHUNKS * Y_CHUNKS;
+    ps->blocks = blocks;
+    ps->x_borders = (X_CHUNKS - 1) * Y_CHUNKS;
+    ps->border_count = ps->x_borders + X_CHUNKS * (Y_CHUNKS - 1);
+    ps->borders = calloc(ps->border_count + 1, sizeof(border));
+    ps->chunks = calloc(chunks, sizeof(chunk_graph));
+    ps->node_base = calloc(chunks, sizeof(int));
+    ps->dirty = malloc(chunks);
+    ps->context_count = pool.count + 1;
+    ps->contexts = calloc(ps->context_count, sizeof(path_context));
+    if (ps->borders == NULL || ps->chunks == NULL || ps->node_base == NULL || ps->dirty == NULL || ps->contexts == NULL) {
+        perror("Failed to allocate path service");
+        exit(EXIT_FAILURE);
+    }
+    for (int c = 0; c < chunks; c++) {
+        int cx = c % X_CHUNKS, cy = c / X_CHUNKS;
+        chunk_graph* g = &ps->chunks[c];
+        g->borders[0] = cx > 0 ? cy * (X_CHUNKS - 1) + cx - 1 : -1;
+        g->borders[1] = cx < X_CHUNKS - 1 ? cy * (X_CHUNKS - 1) + cx : -1;
+        g->borders[2] = cy > 0 ? ps->x_borders + (cy - 1) * X_CHUNKS + cx : -1;
+        g->borders[3] = cy < Y_CHUNKS - 1 ? ps->x_borders + cy * X_CHUNKS + cx : -1;
+    }
+    memset(ps->dirty, 1, chunks);
+    ps->any_dirty = 1;
+    add_edit_listener(path_on_edit, ps);
+    return ps;
+}
+
+void free_path_service(path_service* ps) {
+    remove_edit_listener(path_on_edit, ps);
+    for (int i = 0; i < ps->border_count; i++) free(ps->borders[i].portals);
+    for (int c = 0; c < X_CHUNKS * Y_CHUNKS; c++) free(ps->chunks[c].cost);
+    for (int k = 0; k < ps->context_count; k++) {
+        path_context* ctx = &ps->contexts[k];
+        free(ctx->seen);
+        free(ctx->parent);
+        free(ctx->queue);
+        free(ctx->dist);
+        free(ctx->start_dist);
+        free(ctx->goal_dist);
+        free(ctx->opened);
+        free(ctx->g);
+        free(ctx->from);
+        free(ctx->heap);
+        free(ctx->route);
+    }
+    free(ps->contexts);
+    free(ps->borders);
+    free(ps->chunks);
+    free(ps->node_base);
+    free(ps->node_chunk);
+    free(ps->node_pos);
+    free(ps->node_partner);
+    free(ps->dirty);
+    free(ps);
+}
+
+void heap_push(path_context* ctx, int f, int node) {
+    if (ctx->heap_count == ctx->heap_cap) {
+        // stale entries can pile up on dense graphs
+        ctx->heap_cap *= 2;
+        ctx->heap = realloc(ctx->heap, sizeof(heap_entry) * ctx->heap_cap);
+        if (ctx->heap == NULL) {
+            perror("Failed to allocate path heap");
+            exit(EXIT_FAILURE);
+        }
+    }
+    int i = ctx->heap_count++;
+    while (i > 0 && ctx->heap[(i - 1) / 2].f > f) {
+        ctx->heap[i] = ctx->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    ctx->heap[i].f = f;
+    ctx->heap[i].node = node;
+}
+
+heap_entry heap_pop(path_context* ctx) {
+    heap_entry top = ctx->heap[0];
+    heap_entry last = ctx->heap[--ctx->heap_count];
+    int i = 0;
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= ctx->heap_count) break;
+        if (c + 1 < ctx->heap_count && ctx->heap[c + 1].f < ctx->heap[c].f) c++;
+        if (ctx->heap[c].f >= last.f) break;
+        ctx->heap[i] = ctx->heap[c];
+        i = c;
+    }
+    if (ctx->heap_count > 0) ctx->heap[i] = last;
+    return top;
+}
+
+//relax an edge of the abstract search
+void path_relax(path_context* ctx, int from, int to, int cost, int h) {
+    int g = ctx->g[from] + cost;
+    if (ctx->opened[to] != ctx->search || g < ctx->g[to]) {
+        ctx->opened[to] = ctx->search;
+        ctx->g[to] = g;
+        ctx->from[to] = from;
+        heap_push(ctx, g + h, to);
+    }
+}
+
+//append the steps of the last chunk search from its start to p, excluding the start
+int path_append(path_context* ctx, int chunk, block_pos p, path_query* q) {
+    int i = chunk_cell_index(chunk, p);
+    int n = ctx->dist[i];
+    if (q->length + n > q->max_steps) return 0;
+    for (int k = n - 1; k >= 0; k--) {
+        q->steps[q->length + k] = chunk_cell_pos(chunk, i);
+        i = ctx->parent[i];
+    }
+    q->length += n;
+    return 1;
+}
+
+//answer one query with the buffers of ctx
+void path_find(path_service* ps, path_context* ctx, path_query* q) {
+    q->length = 0;
+    block_pos s = q->start, t = q->goal;
+    if (!walk_standable(ps->blocks, s.x, s.y, s.z) || !walk_standable(ps->blocks, t.x, t.y, t.z) || q->max_steps < 1) {
+        return;
+    }
+    int sc = chunk_of(s.x, s.y), tc = chunk_of(t.x, t.y);
+    q->steps[q->length++] = s;
+
+    // paths that stay inside one chunk don't need the abstract graph
+    if (sc == tc) {
+        path_chunk_search(ps, ctx, sc, s);
+        if (path_chunk_dist(ctx, sc, t) != PATH_INF) {
+            if (!path_append(ctx, sc, t, q)) q->length = 0;
+            return;
+        }
+    }
+
+    chunk_graph* sg = &ps->chunks[sc];
+    chunk_graph* tg = &ps->chunks[tc];
+    path_chunk_search(ps, ctx, tc, t);
+    for (int i = 0; i < tg->start[4]; i++) {
+        ctx->goal_dist[i] = path_chunk_dist(ctx, tc, ps->node_pos[ps->node_base[tc] + i]);
+    }
+    path_chunk_search(ps, ctx, sc, s);
+    for (int i = 0; i < sg->start[4]; i++) {
+        ctx->start_dist[i] = path_chunk_dist(ctx, sc, ps->node_pos[ps->node_base[sc] + i]);
+    }
+
+    // A* over the portal graph, the start and goal are two extra nodes
+    int start = ps->node_total, goal = ps->node_total + 1;
+    ctx->search++;
+    ctx->heap_count = 0;
+    ctx->opened[start] = ctx->search;
+    ctx->g[start] = 0;
+    ctx->from[start] = -1;
+    heap_push(ctx, 0, start);
+    int found = 0;
+    while (ctx->heap_count > 0) {
+        heap_entry top = heap_pop(ctx);
+        int u = top.node;
+        if (u == goal) {
+            found = 1;
+            break;
+        }
+        block_pos up = u == start ? s : ps->node_pos[u];
+        if (top.f > ctx->g[u] + abs(up.x - t.x) + abs(up.y - t.y)) continue;   // stale entry
+
+        if (u == start) {
+            for (int i = 0; i < sg->start[4]; i++) {
+                if (ctx->start_dist[i] == PATH_INF) continue;
+                int v = ps->node_base[sc] + i;
+                block_pos p = ps->node_pos[v];
+                path_relax(ctx, u, v, ctx->start_dist[i], abs(p.x - t.x) + abs(p.y - t.y));
+            }
+            continue;
+        }
+        int c = ps->node_chunk[u];
+        int i = u - ps->node_base[c];
+        chunk_graph* g = &ps->chunks[c];
+        int n = g->start[4];
+        if (c == tc && ctx->goal_dist[i] != PATH_INF) {
+            path_relax(ctx, u, goal, ctx->goal_dist[i], 0);
+        }
+        const uint16_t* costs = &g->cost[i * n];
+        for (int j = 0; j < n; j++) {
+            if (j == i || costs[j] == PATH_INF) continue;
+            int v = ps->node_base[c] + j;
+            block_pos p = ps->node_pos[v];
+            path_relax(ctx, u, v, costs[j], abs(p.x - t.x) + abs(p.y - t.y));
+        }
+        int v = ps->node_partner[u];
+        block_pos p = ps->node_pos[v];
+        path_relax(ctx, u, v, 1, abs(p.x - t.x) + abs(p.y - t.y));
+    }
+    if (!found) {
+        q->length = 0;
+        return;
+    }
+
+    // walk the abstract route back, then fill in the steps between its nodes
+    int count = 0;
+    for (int u = goal; u != -1; u = ctx->from[u]) ctx->route[count++] = u;
+    block_pos at = s;
+    int at_chunk = sc;
+    for (int k = count - 2; k >= 0; k--) {
+        int v = ctx->route[k];
+        block_pos p = v == goal ? t : ps->node_pos[v];
+        int pc = v == goal ? tc : ps->node_chunk[v];
+        if (pc != at_chunk) {
+            // crossing a portal is a single step
+            if (q->length == q->max_steps) {
+                q->length = 0;
+                return;
+            }
+            q->steps[q->length++] = p;
+        }
+        else {
+            path_chunk_search(ps, ctx, pc, at);
+            if (!path_append(ctx, pc, p, q)) {
+                q->length = 0;
+                return;
+            }
+        }
+        at = p;
+        at_chunk = pc;
+    }
+}
+
+void path_queries_job(void* arg, int k) {
+    path_batch* batch = arg;
+    path_context* ctx = &batch->ps->contexts[k];
+    for (int i = k; i < batch->count; i += batch->ps->context_count) {
+        path_find(batch->ps, ctx, &batch->queries[i]);
+    }
+}
+
+//answer a batch of queries across the worker pool
+void path_find_batch(path_service* ps, path_query* queries, int count) {
+    path_rebuild(ps);
+    path_batch batch = { ps, queries, count, NULL };
+    parallel_for(ps->context_count < count ? ps->context_count : count, path_queries_job, &batch);
+}
+
+/*
+    raycast queries
+
+    gameplay asks what a ray runs into: the targeted block, line of sight between two points,
+    where a projectile lands. a query walks the same cells as the renderer (ray_walk) and stops
+    at the first cell whose flags share a bit with its stop_flags, so a line of sight check can
+    pass BLOCK_OPAQUE to look through glass and water while targeting stops at anything.
+
+    raycast_batch answers many queries at once across the worker pool. the queries are sorted
+    so rays starting in the same chunk and heading the same way run together and walk the same
+    cache lines, then handed out in groups of RAY_GROUP.
+*/
+#define RAY_ANY_BLOCK (BLOCK_SOLID | BLOCK_OPAQUE | BLOCK_TRANSPARENT)
+#define RAY_GROUP 64
+#define RAY_MAX_BATCH (1 << 24)   // the sort key keeps the query index in 24 bits
+
+typedef struct RayHit {
+    int hit;                  // 0 if the ray left the world or went past max_distance
+    int x, y, z;              // cell that was hit
+    int face;                 // face the ray came in through, 0..5 for -x, +x, -y, +y, -z, +z, -1 if it started inside
+    float distance;           // along the ray, in multiples of |dir|
+    char block;
+    vect pos;                 // point in the cell where the ray stopped
+} ray_hit;
+
+typedef struct RayQuery {
+    vect origin;
+    vect dir;
+    float max_distance;       // 0 for no limit
+    int stop_flags;           // block flags the ray stops at
+    ray_hit hit;              // filled in by raycast_batch
+} ray_query;
+
+//which face a step from last moved the ray in through, given the cells it moved by.
+//a step that clips an edge crosses two boundaries, the ray came in through the later one
+static inline int ray_entry_face(vect last, vect dir, int dx, int dy, int dz) {
+    int face = -1;
+    float latest = -1;
+    if (dx != 0) {
+        float t = ((int)last.x + (dx > 0) - last.x) / dir.x;
+        if (t > latest) { latest = t; face = dx > 0 ? 0 : 1; }
+    }
+    if (dy != 0) {
+        float t = ((int)last.y + (dy > 0) - last.y) / dir.y;
+        if (t > latest) { latest = t; face = dy > 0 ? 2 : 3; }
+    }
+    if (dz != 0) {
+        float t = ((int)last.z + (dz > 0) - last.z) / dir.z;
+        if (t > latest) { latest = t; face = dz > 0 ? 4 : 5; }
+    }
+    return face;
+}
+
+typedef struct RaycastState {
+    char*** blocks;
+    int stop_flags;
+    int last_x, last_y, last_z;   // cell before the current one, -1 while in the first
+    vect last;                    // where the ray was in it
+    vect dir;
+    ray_hit* result;
+} raycast_state;
+
+static inline __attribute__((always_inline))
+int raycast_visit(void* ctx, vect pos, int x, int y, int z) {
+    raycast_state* s = ctx;
+    char c = s->blocks[z][y][x];
+    if (block_lut.flags[(unsigned char)c] & s->stop_flags) {
+        s->result->hit = 1;
+        s->result->x = x;
+        s->result->y = y;
+        s->result->z = z;
+        s->result->face = s->last_x < 0 ? -1 : ray_entry_face(s->last, s->dir, x - s->last_x, y - s->last_y, z - s->last_z);
+        s->result->block = c;
+        return 1;
+    }
+    s->last_x = x;
+    s->last_y = y;
+    s->last_z = z;
+    s->last = pos;
+    return 0;
+}
+
+//cast one ray from pos along dir, see ray_query for the arguments
+ray_hit raycast(vect pos, vect dir, float max_distance, int stop_flags, char*** blocks) {
+    ray_hit result = { 0, -1, -1, -1, -1, 0, ' ', pos };
+    raycast_state s = { blocks, stop_flags, -1, -1, -1, pos, dir, &result };
+    ray_walk(&pos, dir, max_distance, raycast_visit, &s, &result.distance);
+    result.pos = pos;
+    return result;
+}
+
+typedef struct RayBatch {
+    char*** blocks;
+    ray_query* queries;
+    uint64_t* order;          // sort keys, the low 24 bits are the query index
+    int count;
+} ray_batch;
+
+//rays that start in the same chunk and point into the same octant and rough direction sort together
+uint64_t ray_coherence_key(ray_query* q) {
+    // origins outside the world are clamped to it, those rays miss straight away anyway
+    float ox = q->origin.x > 0 ? q->origin.x < X_BLOCKS ? q->origin.x : X_BLOCKS - 1 : 0;
+    float oy = q->origin.y > 0 ? q->origin.y < Y_BLOCKS ? q->origin.y : Y_BLOCKS - 1 : 0;
+    float oz = q->origin.z > 0 ? q->origin.z < Z_BLOCKS ? q->origin.z : Z_BLOCKS - 1 : 0;
+    uint64_t chunk = ((uint64_t)((int)oz >> CHUNK_SHIFT) * Y_CHUNKS + ((int)oy >> CHUNK_SHIFT)) * X_CHUNKS
+        + ((int)ox >> CHUNK_SHIFT);
+    int octant = (q->dir.x < 0) | (q->dir.y < 0) << 1 | (q->dir.z < 0) << 2;
+    // the dominant direction within the octant, two bits per axis
+    float len = fabsf(q->dir.x) + fabsf(q->dir.y) + fabsf(q->dir.z) + 1e-6f;
+    int qx = (int)(fabsf(q->dir.x) / len * 3.99f), qy = (int)(fabsf(q->dir.y) / len * 3.99f);
+    return ((chunk << 3 | octant) << 4 | qx << 2 | qy) << 24;
+}
+
+void ray_group_job(void* arg, int k) {
+    ray_batch* batch = arg;
+    int end = (k + 1) * RAY_GROUP < batch->count ? (k + 1) * RAY_GROUP : batch->count;
+    for (int i = k * RAY_GROUP; i < end; i++) {
+        ray_query* q = &batch->queries[batch->order[i] & (RAY_MAX_BATCH - 1)];
+        q->hit = raycast(q->origin, q->dir, q->max_distance, q->stop_flags, batch->blocks);
+    }
+}
+
+//radix sort the keys on the bits above the query index, a byte per pass, returns whichever
+//of the two buffers ends up holding the sorted keys
+uint64_t* ray_sort(uint64_t* keys, uint64_t* scratch, int count) {
+    uint64_t used = 0;
+    for (int i = 0; i < count; i++) used |= keys[i];
+    for (int shift = 24; shift < 64 && (used >> shift) != 0; shift += 8) {
+        int start[257] = { 0 };
+        for (int i = 0; i < count; i++) start[((keys[i] >> shift) & 255) + 1]++;
+        for (int b = 0; b < 256; b++) start[b + 1] += start[b];
+        for (int i = 0; i < count; i++) scratch[start[(keys[i] >> shift) & 255]++] = keys[i];
+        uint64_t* sorted = scratch;
+        scratch = keys;
+        keys = sorted;
+    }
+    return keys;
+}
+
+//answer a batch of ray queries across the worker pool, at most RAY_MAX_BATCH at a time
+void raycast_batch(char*** blocks, ray_query* queries, int count) {
+    if (count <= 0) return;
+    if (count > RAY_MAX_BATCH) {
+        raycast_batch(blocks, queries + RAY_MAX_BATCH, count - RAY_MAX_BATCH);
+        count = RAY_MAX_BATCH;
+    }
+    uint64_t* keys = malloc(2 * count * sizeof(uint64_t));
+    if (keys == NULL) {
+        perror("Failed to allocate ray batch");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++) {
+        keys[i] = ray_coherence_key(&queries[i]) | (uint64_t)i;
+    }
+    ray_batch batch = { blocks, queries, ray_sort(keys, keys + count, count), count };
+    parallel_for((count + RAY_GROUP - 1) / RAY_GROUP, ray_group_job, &batch);
+    free(keys);
+}
+
+// Function to update the player's position and viewing direction based on input
+void update_pos_view(player_pos_view* posview, char*** blocks) {
+    float move_eps = 0.30;  // Movement speed
+    float tilt_eps = 0.1;   // Rotation speed
+    
+    // Check bounds before casting to int
+    int x = (int)posview->pos.x;
+    int y = (int)posview->pos.y;
+    int z = (int)posview->pos.z - EYE_HEIGHT + 0.01;
+    
+    // Ensure we're within bounds
+    if (x >= 0 && x < X_BLOCKS && y >= 0 && y < Y_BLOCKS && z >= 0 && z < Z_BLOCKS) {
+        // Push player upward if embedded in a solid block, water can be waded through
+        if (block_lut.flags[(unsigned char)blocks[z][y][x]] & BLOCK_SOLID) {
+            posview->pos.z += 1;
+        }
+    }
+
+    z = (int)posview->pos.z - EYE_HEIGHT - 0.01;
+    if (x >= 0 && x < X_BLOCKS && y >= 0 && y < Y_BLOCKS && z >= 0 && z < Z_BLOCKS) {
+        // Push player downward if nothing solid is underfoot
+        if (!(block_lut.flags[(unsigned char)blocks[z][y][x]] & BLOCK_SOLID)) {
+            posview->pos.z -= 1;
+        }
+    }
+
+    // Adjust the view angles based on rotation key inputs
+    if (is_key_pressed('w')) posview->view.psi += tilt_eps;
+    if (is_key_pressed('s')) posview->view.psi -= tilt_eps;
+    if (is_key_pressed('d')) posview->view.phi += tilt_eps;
+    if (is_key_pressed('a')) posview->view.phi -= tilt_eps;
+
+    // Clamp psi to prevent over-rotation
+    if (posview->view.psi > M_PI/2) posview->view.psi = M_PI/2;
+    if (posview->view.psi < -M_PI/2) posview->view.psi = -M_PI/2;
+
+    // Calculate movement direction from angles
+    vect direction = angles_to_vect(posview->view);
+
+    // Move forward/backward/strafe using direction vector
+    if (is_key_pressed('i')) {
+        posview->pos.x += move_eps * direction.x;
+        posview->pos.y += move_eps * direction.y;
+    }
+    if (is_key_pressed('k')) {
+        posview->pos.x -= move_eps * direction.x;
+        posview->pos.y -= move_eps * direction.y;
+    }
+    if (is_key_pressed('j')) {
+        posview->pos.x += move_eps * direction.y;
+        posview->pos.y -= move_eps * direction.x;
+    }
+    if (is_key_pressed('l')) {
+        posview->pos.x -= move_eps * direction.y;
+        posview->pos.y += move_eps * direction.x;
+    }
+
+    // Clamp position to world bounds
+    if (posview->pos.x < 0) posview->pos.x = 0;
+    if (posview->pos.x >= X_BLOCKS) posview->pos.x = X_BLOCKS - 0.01;
+    if (posview->pos.y < 0) posview->pos.y = 0;
+    if (posview->pos.y >= Y_BLOCKS) posview->pos.y = Y_BLOCKS - 0.01;
+    if (posview->pos.z < EYE_HEIGHT) posview->pos.z = EYE_HEIGHT;
+    if (posview->pos.z >= Z_BLOCKS) posview->pos.z = Z_BLOCKS - 0.01;
 }
 
 // Function to trace a ray from the player's view until it hits a non-empty block
-vect get_current_block(player_pos_view posview, char*** blocks) {
-    vect pos = posview.pos;
-    vect dir = angles_to_vect(posview.view); // Get direction vector from view
-    float eps = 0.01;
+ray_hit get_current_block(player_pos_view posview, char*** blocks) {
+    return raycast(posview.pos, angles_to_vect(posview.view), 0, RAY_ANY_BLOCK, blocks);
+}
+
+// Function to place a new block against the face of the block being looked at
+void place_block(ray_hit target, char*** blocks, char block, edit_journal* journal) {
+    // Nothing to place against if the ray missed or started inside the block
+    if (!target.hit || target.face < 0) {
+        return;
+    }
+    int x = target.x, y = target.y, z = target.z;
+    int side = target.face & 1 ? 1 : -1;   // even faces look towards -axis
+    switch (target.face >> 1) {
+        case 0: x += side; break;
+        case 1: y += side; break;
+        case 2: z += side; break;
+    }
+    // region_fill drops it if out of bounds
+    region_fill(blocks, region_cell(x, y, z), block, journal);
+}
+
+/*
+    reference renderer
 
-    // Keep moving until the ray exits the world
+    the plain traversal the renderer started out with, kept as the oracle for --diff-check.
+    don't optimise these, every fast path is checked against them.
+*/
+//depth and cell of a reference ray from origin that stopped at pos
+void reference_surface(vect origin, vect pos, float* depth, int32_t* cell) {
+    vect d = vect_sub(pos, origin);
+    *depth = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+    *cell = ((int)pos.z * Y_BLOCKS + (int)pos.y) * X_BLOCKS + (int)pos.x;
+}
+
+int reference_opaque(char*** blocks, int x, int y, int z) {
+    if (x < 0 || x >= X_BLOCKS || y < 0 || y >= Y_BLOCKS || z < 0 || z >= Z_BLOCKS) return 0;
+    const block_type* type = find_block_type(blocks[z][y][x]);
+    return blocks[z][y][x] != ' ' && (type == NULL || (type->flags & BLOCK_OPAQUE));
+}
+
+//occlusion of a face corner counted from the cells around the corner's vertex v on the side
+//the face looks at: the two beside the cell in front of the face, and the one diagonal to it
+int reference_corner(char*** blocks, const int block[3], const int v[3], int axis, int front) {
+    int u = axis == 0 ? 1 : 0, w = axis == 2 ? 1 : 2;
+    int sides = 0, corner = 0;
+    for (int cu = v[u] - 1; cu <= v[u]; cu++) {
+        for (int cw = v[w] - 1; cw <= v[w]; cw++) {
+            int c[3];
+            c[axis] = front;
+            c[u] = cu;
+            c[w] = cw;
+            int away = (cu != block[u]) + (cw != block[w]);
+            if (away == 0 || !reference_opaque(blocks, c[0], c[1], c[2])) continue;
+            if (away == 1) sides++;
+            else corner++;
+        }
+    }
+    return sides == 2 ? 3 : sides + corner;
+}
+
+//ambient occlusion glyph of a hit at pos on block (x, y, z), worked out from its neighbours
+char reference_shade(char*** blocks, const block_type* type, vect pos, vect dir, int x, int y, int z) {
+    float f[3] = { pos.x - x, pos.y - y, pos.z - z };
+    float d[3] = { dir.x, dir.y, dir.z };
+    // the ray came in through the face it's nearest to on the side it came from
+    int axis = 0;
+    float nearest = 2;
+    for (int i = 0; i < 3; i++) {
+        float to_face = d[i] > 0 ? f[i] : 1 - f[i];
+        if (to_face < nearest) {
+            nearest = to_face;
+            axis = i;
+        }
+    }
+    int block[3] = { x, y, z };
+    int front = d[axis] > 0 ? block[axis] - 1 : block[axis] + 1;
+    int u = axis == 0 ? 1 : 0, w = axis == 2 ? 1 : 2;
+    float c[2][2];
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            int v[3];
+            v[axis] = 0;
+            v[u] = block[u] + i;
+            v[w] = block[w] + j;
+            c[i][j] = reference_corner(blocks, block, v, axis, front);
+        }
+    }
+    float fu = f[u], fw = f[w];
+    float occlusion = fu >= fw ? c[0][0] + fu * (c[1][0] - c[0][0]) + fw * (c[1][1] - c[1][0])
+                               : c[0][0] + fw * (c[0][1] - c[0][0]) + fu * (c[1][1] - c[0][1]);
+    int level = (int)(occlusion + 0.5f);
+    return level == 0 ? type->glyph : type->shades[level - 1];
+}
+
+char reference_raytrace(vect pos, vect dir, char*** blocks, float* depth, int32_t* cell, uint8_t* colour) {
+    float eps = 0.01;
+    int tint = 0;
+    char medium = ' ';
+    int last_x = -1, last_y = -1, last_z = -1;
+    vect origin = pos;
     while (!ray_outside(pos)) {
         int z = (int)pos.z;
         int y = (int)pos.y;
         int x = (int)pos.x;
-        
-        // Check bounds before accessing
         if (z < 0 || z >= Z_BLOCKS || y < 0 || y >= Y_BLOCKS || x < 0 || x >= X_BLOCKS) {
             break;
         }
-        
         char c = blocks[z][y][x];
-        if (c != ' ') {
-            return pos;  // Found a block!
+        const block_type* type = find_block_type(c);
+        if (c != ' ' && (type == NULL || !(type->flags & BLOCK_TRANSPARENT))) {
+            reference_surface(origin, pos, depth, cell);
+            int border = on_block_border(pos);
+            char shown = border ? '-' : c;
+            if (!border && ao.blocks == blocks && type != NULL && type->shades != NULL) {
+                shown = reference_shade(blocks, type, pos, dir, x, y, z);
+            }
+            *colour = block_lut.colour[(unsigned char)(tint > 0 ? medium : shown)];
+            return shown;
+        }
+        if (type != NULL && (type->flags & BLOCK_TRANSPARENT)) {
+            if ((type->flags & BLOCK_OUTLINED) && on_block_border(pos)) {
+                reference_surface(origin, pos, depth, cell);
+                *colour = block_lut.colour[(unsigned char)(tint > 0 ? medium : '-')];
+                return '-';
+            }
+            if (x != last_x || y != last_y || z != last_z) {
+                tint += type->tint;
+                medium = c;
+                if (tint >= TINT_FULL) {
+                    reference_surface(origin, pos, depth, cell);
+                    *colour = block_lut.colour[(unsigned char)c];
+                    return c;
+                }
+            }
+            last_x = x;
+            last_y = y;
+            last_z = z;
         }
-
         float dist = 2;
-
-        // Calculate smallest distance to the next voxel boundary on each axis
         if (dir.x > eps) dist = min(dist, ((int)(pos.x + 1) - pos.x) / dir.x);
         else if (dir.x < -eps) dist = min(dist, ((int)pos.x - pos.x) / dir.x);
         if (dir.y > eps) dist = min(dist, ((int)(pos.y + 1) - pos.y) / dir.y);
         else if (dir.y < -eps) dist = min(dist, ((int)pos.y - pos.y) / dir.y);
         if (dir.z > eps) dist = min(dist, ((int)(pos.z + 1) - pos.z) / dir.z);
         else if (dir.z < -eps) dist = min(dist, ((int)pos.z - pos.z) / dir.z);
+        pos = vect_add(pos, vect_scale(dist + eps, dir));
+    }
+    *depth = FRAME_FAR;
+    *cell = FRAME_NO_CELL;
+    *colour = block_lut.colour[(unsigned char)medium];
+    return tint > 0 ? medium : ' ';
+}
+
+void reference_picture(framebuffer* picture, player_pos_view posview, char*** blocks) {
+    vect** directions = init_directions(posview.view);
+    for (int y = 0; y < Y_PIXELS; y++) {
+        for (int x = 0; x < X_PIXELS; x++) {
+            size_t i = (size_t)y * X_PIXELS + x;
+            picture->glyph[i] = reference_raytrace(posview.pos, directions[y][x], blocks, &picture->depth[i],
+                &picture->cell[i], &picture->colour[i]);
+        }
+        free(directions[y]);
+    }
+    free(directions);
+}
 
-        // Move ray forward by calculated step
+vect reference_raycast(vect pos, vect dir, char*** blocks) {
+    float eps = 0.01;
+    while (!ray_outside(pos)) {
+        int z = (int)pos.z;
+        int y = (int)pos.y;
+        int x = (int)pos.x;
+        if (z < 0 || z >= Z_BLOCKS || y < 0 || y >= Y_BLOCKS || x < 0 || x >= X_BLOCKS) {
+            break;
+        }
+        if (blocks[z][y][x] != ' ') {
+            return pos;
+        }
+        float dist = 2;
+        if (dir.x > eps) dist = min(dist, ((int)(pos.x + 1) - pos.x) / dir.x);
+        else if (dir.x < -eps) dist = min(dist, ((int)pos.x - pos.x) / dir.x);
+        if (dir.y > eps) dist = min(dist, ((int)(pos.y + 1) - pos.y) / dir.y);
+        else if (dir.y < -eps) dist = min(dist, ((int)pos.y - pos.y) / dir.y);
+        if (dir.z > eps) dist = min(dist, ((int)(pos.z + 1) - pos.z) / dir.z);
+        else if (dir.z < -eps) dist = min(dist, ((int)pos.z - pos.z) / dir.z);
         pos = vect_add(pos, vect_scale(dist + eps, dir));
     }
+    return pos;
+}
 
-    return pos; // Return last position before exiting bounds
+vect reference_current_block(player_pos_view posview, char*** blocks) {
+    return reference_raycast(posview.pos, angles_to_vect(posview.view), blocks);
 }
 
-// Function to place a new block adjacent to the one being looked at
-void place_block(vect pos, char*** blocks, char block) {
-    int x = (int)pos.x, y = (int)pos.y, z = (int)pos.z;
-    
-    // Check if the current position is within bounds
-    if (z < 0 || z >= Z_BLOCKS || y < 0 || y >= Y_BLOCKS || x < 0 || x >= X_BLOCKS) {
-        return;
+/*
+    differential check
+
+    renders random worlds from random cameras with both the game's renderer and the reference
+    and compares every channel of the frames, the targeted block and a raycast through every
+    pixel. worlds are built with ambient occlusion on, which the reference works out from the
+    neighbours of every hit instead of keeping it up to date. a failing case is shrunk by
+    removing blocks for as long as it keeps failing, then printed so it can be replayed.
+    afterwards every fast kernel is timed against its reference on the default scene.
+*/
+#define DIFF_SHRINK_TRIES 4096
+
+typedef struct DiffCase {
+    dimensions size;
+    player_pos_view posview;
+    uint64_t seed;
+} diff_case;
+
+uint64_t diff_random(uint64_t* state) {
+    // xorshift64*
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+float diff_uniform(uint64_t* state, float lo, float hi) {
+    return lo + (hi - lo) * (float)(diff_random(state) >> 40) / (float)(1 << 24);
+}
+
+//fill a world with ground, boxes and loose blocks
+void diff_world(char*** blocks, uint64_t seed) {
+    uint64_t rng = seed | 1;
+    const char glyphs[] = "@@@#%:~=";
+    region ground = { 0, 0, 0, X_BLOCKS, Y_BLOCKS, (int)(diff_random(&rng) % 5) };
+    region_fill(blocks, ground, '@', NULL);
+    int boxes = (int)(diff_random(&rng) % 12);
+    for (int i = 0; i < boxes; i++) {
+        int x = (int)(diff_random(&rng) % X_BLOCKS), y = (int)(diff_random(&rng) % Y_BLOCKS);
+        int z = (int)(diff_random(&rng) % Z_BLOCKS);
+        region box = { x, y, z, x + 1 + (int)(diff_random(&rng) % 6), y + 1 + (int)(diff_random(&rng) % 6),
+            z + 1 + (int)(diff_random(&rng) % 4) };
+        region_fill(blocks, box, glyphs[diff_random(&rng) % 8], NULL);
     }
+    int loose = (int)(diff_random(&rng) % (X_BLOCKS * Y_BLOCKS / 4 + 1));
+    for (int i = 0; i < loose; i++) {
+        int z = (int)(diff_random(&rng) % Z_BLOCKS), y = (int)(diff_random(&rng) % Y_BLOCKS);
+        int x = (int)(diff_random(&rng) % X_BLOCKS);
+        region_fill(blocks, region_cell(x, y, z), glyphs[diff_random(&rng) % 8], NULL);
+    }
+}
+
+diff_case diff_make_case(uint64_t seed) {
+    static const dimensions worlds[] = {
+        { 0, 0, 20, 20, 10, 0 }, { 0, 0, 32, 32, 16, 0 }, { 0, 0, 64, 64, 16, 0 }, { 0, 0, 13, 27, 9, 0 },
+        { 0, 0, 8, 8, 8, 0 },
+    };
+    uint64_t rng = seed * 0x9E3779B97F4A7C15ull + 1;
+    diff_case c;
+    c.seed = seed;
+    c.size = worlds[diff_random(&rng) % (sizeof(worlds) / sizeof(worlds[0]))];
+    c.size.x_pixels = 2 + (int)(diff_random(&rng) % 160);
+    c.size.y_pixels = 2 + (int)(diff_random(&rng) % 60);
+    c.posview.pos.x = diff_uniform(&rng, 0, c.size.x_blocks - 0.01f);
+    c.posview.pos.y = diff_uniform(&rng, 0, c.size.y_blocks - 0.01f);
+    c.posview.pos.z = diff_uniform(&rng, 0, c.size.z_blocks - 0.01f);
+    c.posview.view.psi = diff_uniform(&rng, -M_PI / 2, M_PI / 2);
+    c.posview.view.phi = diff_uniform(&rng, -M_PI, M_PI);
+    return c;
+}
 
-    // Compute distances to each face of the block to determine the nearest face
-    float dists[6];
-    dists[0] = fabsf(x + 1 - pos.x);  // +X face
-    dists[1] = fabsf(pos.x - x);      // -X face
-    dists[2] = fabsf(y + 1 - pos.y);  // +Y face
-    dists[3] = fabsf(pos.y - y);      // -Y face
-    dists[4] = fabsf(z + 1 - pos.z);  // +Z face
-    dists[5] = fabsf(pos.z - z);      // -Z face
+//does a raycast agree with the reference walk
+int diff_ray_matches(ray_hit* a, vect b) {
+    if (memcmp(&a->pos, &b, sizeof(vect)) != 0 || a->hit == ray_outside(b)) return 0;
+    return !a->hit || (a->x == (int)b.x && a->y == (int)b.y && a->z == (int)b.z);
+}
+
+//cast a batch of rays through every pixel and check them against the reference,
+//returns the first differing pixel as y * width + x or -1
+int diff_raycasts(char*** blocks, player_pos_view posview) {
+    vect** directions = init_directions(posview.view);
+    int count = X_PIXELS * Y_PIXELS;
+    ray_query* queries = malloc(count * sizeof(ray_query));
+    if (queries == NULL) {
+        perror("Failed to allocate ray queries");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++) {
+        ray_query q = { posview.pos, directions[i / X_PIXELS][i % X_PIXELS], 0, RAY_ANY_BLOCK, { 0 } };
+        queries[i] = q;
+    }
+    raycast_batch(blocks, queries, count);
+    int at = -1;
+    for (int i = 0; i < count && at < 0; i++) {
+        if (!diff_ray_matches(&queries[i].hit, reference_raycast(queries[i].origin, queries[i].dir, blocks))) at = i;
+    }
+    for (int y = 0; y < Y_PIXELS; y++) free(directions[y]);
+    free(directions);
+    free(queries);
+    return at;
+}
 
-    // Find the index of the minimum distance face
-    int min_idx = 0;
-    float mindist = dists[0];
-    for (int i = 0; i < 6; i++) {
-        if (dists[i] < mindist) {
-            mindist = dists[i];
-            min_idx = i;
+//compare both renderers on one world, returns the first differing pixel as y * width + x,
+//X_PIXELS * Y_PIXELS if only the targeted block differs, X_PIXELS * Y_PIXELS + 1 + the pixel
+//if a raycast through it does, or -1 if everything matches
+int diff_compare(char*** blocks, player_pos_view posview, framebuffer* fast, framebuffer* slow) {
+    get_picture(fast, posview, blocks);
+    reference_picture(slow, posview, blocks);
+    for (int i = 0; i < X_PIXELS * Y_PIXELS; i++) {
+        if (fast->glyph[i] != slow->glyph[i] || fast->colour[i] != slow->colour[i] || fast->cell[i] != slow->cell[i]
+            || memcmp(&fast->depth[i], &slow->depth[i], sizeof(float)) != 0) {
+            return i;
         }
     }
+    ray_hit a = get_current_block(posview, blocks);
+    if (!diff_ray_matches(&a, reference_current_block(posview, blocks))) return X_PIXELS * Y_PIXELS;
+    int ray = diff_raycasts(blocks, posview);
+    if (ray >= 0) return X_PIXELS * Y_PIXELS + 1 + ray;
+    return -1;
+}
 
-    // Place the new block on the nearest adjacent face if within bounds
-    switch (min_idx) {
-        case 0: 
-            if (x + 1 < X_BLOCKS) blocks[z][y][x + 1] = block; 
-            break;
-        case 1: 
-            if (x - 1 >= 0) blocks[z][y][x - 1] = block; 
-            break;
-        case 2: 
-            if (y + 1 < Y_BLOCKS) blocks[z][y + 1][x] = block; 
-            break;
-        case 3: 
-            if (y - 1 >= 0) blocks[z][y - 1][x] = block; 
-            break;
-        case 4: 
-            if (z + 1 < Z_BLOCKS) blocks[z + 1][y][x] = block; 
-            break;
-        case 5: 
-            if (z - 1 >= 0) blocks[z - 1][y][x] = block; 
-            break;
+//remove blocks from a failing world for as long as it keeps failing
+void diff_shrink(char*** blocks, player_pos_view posview, framebuffer* fast, framebuffer* slow) {
+    int cells = X_BLOCKS * Y_BLOCKS * Z_BLOCKS;
+    char* cell = blocks[0][0];
+    int tries = 0;
+    for (int step = cells / 2; step >= 1 && tries < DIFF_SHRINK_TRIES; step /= 2) {
+        for (int start = 0; start < cells && tries < DIFF_SHRINK_TRIES; start += step) {
+            int end = start + step < cells ? start + step : cells;
+            int solid = 0;
+            for (int i = start; i < end; i++) solid |= cell[i] != ' ';
+            if (!solid) continue;
+            char* saved = malloc(end - start);
+            if (saved == NULL) {
+                perror("Failed to allocate shrink buffer");
+                exit(EXIT_FAILURE);
+            }
+            // the layers the cells lie in, so the occlusion around them is brought up to date
+            region layers = { 0, 0, start / (X_BLOCKS * Y_BLOCKS), X_BLOCKS, Y_BLOCKS, (end - 1) / (X_BLOCKS * Y_BLOCKS) + 1 };
+            memcpy(saved, cell + start, end - start);
+            memset(cell + start, ' ', end - start);
+            notify_edit(blocks, layers);
+            tries++;
+            if (diff_compare(blocks, posview, fast, slow) < 0) {
+                memcpy(cell + start, saved, end - start);   // needed to fail, keep it
+                notify_edit(blocks, layers);
+            }
+            free(saved);
+        }
+    }
+}
+
+void diff_report(diff_case* c, char*** blocks, player_pos_view posview, framebuffer* fast, framebuffer* slow) {
+    int at = diff_compare(blocks, posview, fast, slow);
+    printf("MISMATCH seed %llu: world %dx%dx%d, frame %dx%d\n", (unsigned long long)c->seed,
+        X_BLOCKS, Y_BLOCKS, Z_BLOCKS, X_PIXELS, Y_PIXELS);
+    printf("  camera pos (%.9g, %.9g, %.9g) psi %.9g phi %.9g\n", posview.pos.x, posview.pos.y, posview.pos.z,
+        posview.view.psi, posview.view.phi);
+    if (at >= 0 && at < X_PIXELS * Y_PIXELS) {
+        int x = at % X_PIXELS, y = at / X_PIXELS;
+        printf("  pixel (%d, %d): renderer '%c' cell %d depth %.9g, reference '%c' cell %d depth %.9g\n", x, y,
+            fast->glyph[at], fast->cell[at], fast->depth[at], slow->glyph[at], slow->cell[at], slow->depth[at]);
+    }
+    else if (at == X_PIXELS * Y_PIXELS) {
+        ray_hit a = get_current_block(posview, blocks);
+        vect b = reference_current_block(posview, blocks);
+        printf("  targeted block: raycast (%.9g, %.9g, %.9g), reference (%.9g, %.9g, %.9g)\n",
+            a.pos.x, a.pos.y, a.pos.z, b.x, b.y, b.z);
+    }
+    else if (at > X_PIXELS * Y_PIXELS) {
+        int x = (at - X_PIXELS * Y_PIXELS - 1) % X_PIXELS, y = (at - X_PIXELS * Y_PIXELS - 1) / X_PIXELS;
+        vect** directions = init_directions(posview.view);
+        ray_hit a = raycast(posview.pos, directions[y][x], 0, RAY_ANY_BLOCK, blocks);
+        vect b = reference_raycast(posview.pos, directions[y][x], blocks);
+        printf("  raycast through pixel (%d, %d): hit %d at (%.9g, %.9g, %.9g), reference (%.9g, %.9g, %.9g)\n",
+            x, y, a.hit, a.pos.x, a.pos.y, a.pos.z, b.x, b.y, b.z);
+        for (int row = 0; row < Y_PIXELS; row++) free(directions[row]);
+        free(directions);
+    }
+    printf("  blocks left after shrinking:");
+    int shown = 0;
+    for (int z = 0; z < Z_BLOCKS; z++) {
+        for (int y = 0; y < Y_BLOCKS; y++) {
+            for (int x = 0; x < X_BLOCKS; x++) {
+                if (blocks[z][y][x] == ' ') continue;
+                if (shown++ < 64) printf(" (%d,%d,%d)='%c'", x, y, z, blocks[z][y][x]);
+            }
+        }
+    }
+    printf(shown > 64 ? " ... %d in total\n" : " %d in total\n", shown);
+}
+
+//time a kernel, returns the best of a few runs in microseconds
+typedef void (*bench_fn)(void* ctx);
+
+double diff_time(bench_fn fn, void* ctx, int reps) {
+    uint64_t best = UINT64_MAX;
+    for (int run = 0; run < 3; run++) {
+        uint64_t start = now_us();
+        for (int i = 0; i < reps; i++) fn(ctx);
+        uint64_t t = now_us() - start;
+        if (t < best) best = t;
+    }
+    return (double)best / reps;
+}
+
+typedef struct BenchScene {
+    framebuffer* picture;
+    char*** blocks;
+    player_pos_view posview;
+    region box;
+    ray_query* rays;
+    int ray_count;
+} bench_scene;
+
+void bench_frame(void* ctx) {
+    bench_scene* s = ctx;
+    get_picture(s->picture, s->posview, s->blocks);
+}
+
+void bench_reference_frame(void* ctx) {
+    bench_scene* s = ctx;
+    reference_picture(s->picture, s->posview, s->blocks);
+}
+
+void bench_target(void* ctx) {
+    bench_scene* s = ctx;
+    for (int i = 0; i < 1000; i++) get_current_block(s->posview, s->blocks);
+}
+
+void bench_reference_target(void* ctx) {
+    bench_scene* s = ctx;
+    for (int i = 0; i < 1000; i++) reference_current_block(s->posview, s->blocks);
+}
+
+void bench_rays(void* ctx) {
+    bench_scene* s = ctx;
+    raycast_batch(s->blocks, s->rays, s->ray_count);
+}
+
+void bench_reference_rays(void* ctx) {
+    bench_scene* s = ctx;
+    for (int i = 0; i < s->ray_count; i++) reference_raycast(s->rays[i].origin, s->rays[i].dir, s->blocks);
+}
+
+void bench_fill(void* ctx) {
+    bench_scene* s = ctx;
+    region_fill(s->blocks, s->box, '#', NULL);
+    region_fill(s->blocks, s->box, ' ', NULL);
+}
+
+void bench_reference_fill(void* ctx) {
+    bench_scene* s = ctx;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int z = s->box.z0; z < s->box.z1; z++) {
+            for (int y = s->box.y0; y < s->box.y1; y++) {
+                for (int x = s->box.x0; x < s->box.x1; x++) {
+                    s->blocks[z][y][x] = pass ? ' ' : '#';
+                }
+            }
+        }
+    }
+}
+
+void print_speedup(const char* kernel, double reference_us, double fast_us) {
+    printf("%-22s %12.1f %12.1f %9.2fx\n", kernel, reference_us, fast_us, reference_us / fast_us);
+}
+
+//time the fast kernels against their references on the default scene
+void diff_speedups() {
+    dimensions saved = dims;
+    dimensions scene = { 900, 180, 20, 20, 10, 0 };
+    dims = scene;
+    bench_scene s;
+    s.picture = init_picture();
+    s.blocks = init_blocks();
+    region ground = { 0, 0, 0, X_BLOCKS, Y_BLOCKS, 4 };
+    region_fill(s.blocks, ground, '@', NULL);
+    region tower = { 8, 8, 4, 12, 12, 8 };
+    region_fill(s.blocks, tower, '@', NULL);
+    s.posview = init_posview();
+    s.posview.view.psi = -0.3;
+    s.posview.view.phi = 0.6;
+    region air = { 0, 0, 4, X_BLOCKS, Y_BLOCKS, Z_BLOCKS };
+    s.box = air;
+    // line of sight checks from all over the scene in every direction
+    uint64_t rng = 1;
+    s.ray_count = 4096;
+    s.rays = malloc(s.ray_count * sizeof(ray_query));
+    if (s.rays == NULL) {
+        perror("Failed to allocate ray queries");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < s.ray_count; i++) {
+        vect origin = { diff_uniform(&rng, 0, X_BLOCKS), diff_uniform(&rng, 0, Y_BLOCKS), diff_uniform(&rng, 4, Z_BLOCKS) };
+        vect2 angles = { diff_uniform(&rng, -M_PI / 2, M_PI / 2), diff_uniform(&rng, -M_PI, M_PI) };
+        ray_query q = { origin, angles_to_vect(angles), 0, RAY_ANY_BLOCK, { 0 } };
+        s.rays[i] = q;
+    }
+
+    printf("\n%-22s %12s %12s %10s\n", "kernel", "reference us", "fast us", "speedup");
+    print_speedup("frame 900x180", diff_time(bench_reference_frame, &s, 5), diff_time(bench_frame, &s, 5));
+    print_speedup("targeted block x1000", diff_time(bench_reference_target, &s, 20), diff_time(bench_target, &s, 20));
+    print_speedup("fill 20x20x6 twice", diff_time(bench_reference_fill, &s, 200), diff_time(bench_fill, &s, 200));
+    print_speedup("raycast batch x4096", diff_time(bench_reference_rays, &s, 20), diff_time(bench_rays, &s, 20));
+
+    free(s.rays);
+    free_picture(s.picture);
+    free_blocks(s.blocks);
+    dims = saved;
+}
+
+//run the differential check, returns the process exit status
+int diff_check(int iterations, uint64_t seed) {
+    dimensions saved = dims;
+    int failures = 0;
+    pool_init();   // so batched raycasts, edits and occlusion updates run on the workers like in the game
+    for (int i = 0; i < iterations; i++) {
+        diff_case c = diff_make_case(seed + i);
+        dims = c.size;
+        framebuffer* fast = init_picture();
+        framebuffer* slow = init_picture();
+        char*** blocks = init_blocks();
+        init_ao(blocks);   // before the world is built, so it's kept up to date edit by edit
+        diff_world(blocks, c.seed);
+        if (diff_compare(blocks, c.posview, fast, slow) >= 0) {
+            diff_shrink(blocks, c.posview, fast, slow);
+            diff_report(&c, blocks, c.posview, fast, slow);
+            failures++;
+        }
+        free_ao();
+        free_picture(fast);
+        free_picture(slow);
+        free_blocks(blocks);
+    }
+    dims = saved;
+    printf("%d of %d cases matched the reference\n", iterations - failures, iterations);
+    diff_speedups();
+    pool_shutdown();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+    self test
+
+    scripted worlds with a known outcome for the systems the differential check can't compare
+    against a reference: block updates and the simulation. each check prints what it measured
+    and returns 1 if it came out as expected.
+*/
+//a sapling with no room to grow, reported as changed over and over by edits around it,
+//must still wait for exactly one update. returns 1 if it does
+int self_test_scheduler() {
+    dimensions saved = dims;
+    dimensions world = { 2, 2, 20, 20, 10, 0 };
+    dims = world;
+    char*** blocks = init_blocks();
+    region ground = { 0, 0, 0, X_BLOCKS, Y_BLOCKS, 4 };
+    region_fill(blocks, ground, '@', NULL);
+    blocks[4][5][5] = SAPLING;
+    blocks[5][5][5] = '@';
+    tick_scheduler* sched = init_scheduler(blocks);
+    region around = { 3, 3, 3, 8, 8, 7 };
+    for (int i = 0; i < 4 * SAPLING_GROW_TICKS; i++) {
+        notify_edit(blocks, around);
+        scheduler_tick(sched);
+    }
+    tick_wheel* wheel = &sched->wheels[tick_chunk_of(5, 5)];
+    int pending = wheel->count;
+    printf("sapling with no room after %d edit reports: %d update%s pending\n", 4 * SAPLING_GROW_TICKS, pending,
+        pending == 1 ? "" : "s");
+    free_scheduler(sched);
+    free_blocks(blocks);
+    dims = saved;
+    return pending == 1;
+}
+
+//a 256x256 pool of water three deep wakes every one of its cells at once. no tick may
+//update more than SIM_TICK_BUDGET of them, and the carried over chunks must all get their
+//turn, so the pool settles in as few ticks as the budget allows. returns 1 if it does
+int self_test_flood() {
+    dimensions saved = dims;
+    dimensions world = { 2, 2, 256, 256, 4, 0 };
+    dims = world;
+    char*** blocks = init_blocks();
+    region ground = { 0, 0, 0, X_BLOCKS, Y_BLOCKS, 1 };
+    region_fill(blocks, ground, '@', NULL);
+    region pool = { 0, 0, 1, X_BLOCKS, Y_BLOCKS, 4 };
+    region_fill(blocks, pool, WATER, NULL);
+    block_sim* sim = init_sim(blocks);
+    int cells = region_volume(pool);
+    int allowed = (cells + SIM_TICK_BUDGET - 1) / SIM_TICK_BUDGET;
+    uint64_t most = 0;
+    int ticks = 0;
+    uint64_t before = atomic_load(&sim->updates);
+    for (; ticks <= allowed; ticks++) {
+        sim_tick(sim);
+        uint64_t updates = atomic_load(&sim->updates) - before;
+        before += updates;
+        if (updates > most) most = updates;
+        if (updates == 0) break;
     }
+    printf("flood of %d water cells: at most %llu updates per tick (budget %d), settled after %d ticks\n", cells,
+        (unsigned long long)most, SIM_TICK_BUDGET, ticks);
+    free_sim(sim);
+    free_blocks(blocks);
+    dims = saved;
+    return most <= SIM_TICK_BUDGET && ticks == allowed;
+}
+
+//run every self test, returns the process exit status
+int self_test() {
+    pool_init();
+    int failures = 0;
+    if (!self_test_scheduler()) failures++;
+    if (!self_test_flood()) failures++;
+    pool_shutdown();
+    printf(failures ? "%d self test%s failed\n" : "all self tests passed\n", failures, failures == 1 ? "" : "s");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 // Main game loop and setup
-int main() {
-    init_terminal();                         // Prepare terminal for drawing
-    char** picture = init_picture();         // Create 2D array for ASCII rendering
-    char*** blocks = init_blocks();          // Initialize 3D block world
+// usage: ./test [--config FILE] [--record FILE] | [--play FILE [FRAME]] | [--diff-check [CASES [SEED]]] | [--self-test]
+int main(int argc, char** argv) {
+    const char* record_path = NULL;
+    const char* world_path = "world";
+    int fps = DEFAULT_FPS;
+    int report_latency = 0;
+    const char* config_path = "minecraft.conf";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            config_path = argv[++i];
+        }
+    }
+    init_block_types();                      // Glyphs, colours and behaviour of every block
+    register_plant_types();                  // Saplings, wood and leaves, which grow and wither
+    init_dimensions(config_path);            // Frame size from the terminal, world size from the config
 
-    // Create a flat ground of blocks ('@') in the lower levels
-    for (int x = 0; x < X_BLOCKS; x++) {
-        for (int y = 0; y < Y_BLOCKS; y++) {
-            for (int z = 0; z < 4; z++) {
-                blocks[z][y][x] = '@';
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--play") == 0 && i + 1 < argc) {
+            uint32_t start = i + 2 < argc ? (uint32_t)strtoul(argv[i + 2], NULL, 10) : 0;
+            return play_recording(argv[i + 1], start);
+        }
+        if (strcmp(argv[i], "--diff-check") == 0) {
+            int cases = i + 1 < argc ? atoi(argv[i + 1]) : 200;
+            uint64_t seed = i + 2 < argc ? strtoull(argv[i + 2], NULL, 10) : 1;
+            return diff_check(cases > 0 ? cases : 200, seed);
+        }
+        if (strcmp(argv[i], "--self-test") == 0) {
+            return self_test();
+        }
+        if (strcmp(argv[i], "--trace-log") == 0 && i + 1 < argc) {
+#ifdef TRACE_STATS
+            stats.log = fopen(argv[++i], "w");
+            if (stats.log == NULL) {
+                perror("Failed to open trace log");
+                return EXIT_FAILURE;
             }
+#else
+            fprintf(stderr, "--trace-log needs a build with -DTRACE_STATS\n");
+            return EXIT_FAILURE;
+#endif
+        }
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        }
+        if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            fps = clamp_int(atoi(argv[++i]), 1, 1000);
+        }
+        if (strcmp(argv[i], "--world") == 0 && i + 1 < argc) {
+            world_path = argv[++i];
+        }
+        if (strcmp(argv[i], "--latency") == 0) {
+            report_latency = 1;
         }
     }
 
+    recorder* rec = NULL;
+    if (record_path != NULL) {
+        rec = recorder_open(record_path);
+        if (rec == NULL) return EXIT_FAILURE;
+    }
+
+    init_terminal();                         // Prepare terminal for drawing
+    framebuffer* picture = init_picture();   // Create the frame the scene is rendered into
+    char*** blocks = init_blocks();          // Initialize 3D block world
+
+    pool_init();                             // Start worker threads for bulk edits
+    edit_journal journal = { 0 };            // Undo history of block edits
+
+    // Create a flat ground of blocks ('@') in the lower levels
+    region ground = { 0, 0, 0, X_BLOCKS, Y_BLOCKS, 4 };
+    region_fill(blocks, ground, '@', NULL);
+    world_log* wal = wal_open(world_path, blocks); // Bring back the saved world and keep saving it
+    init_ao(blocks);                         // Shade corners hemmed in by other blocks
+    block_sim* sim = init_sim(blocks);       // Falling sand and flowing water
+    tick_scheduler* ticks = init_scheduler(blocks); // Delayed and random block updates
+    path_service* paths = init_path_service(blocks); // Navigation for walking along routes
+
+    block_pos route[256];                    // Route picked with 'p', walked one block per frame
+    path_query walk = { .steps = route, .max_steps = 256 };
+    int route_at = 0;
+#ifdef TRACE_STATS
+    int show_heatmap = 0;                    // 'h' shows the cost of each ray instead of the scene
+#endif
+
     player_pos_view posview = init_posview(); // Initialize player position and view
+    ray_hit selected = get_current_block(posview, blocks); // Block looked at, found once per frame
+    char status[128];                         // Status line about the block looked at
+    frame_pacer pacer;
+    pacer_init(&pacer, fps);                  // Frame deadlines at the target rate
+    static latency_stats latency;             // Key arrival to frame written
 
     while (1) {
+        pacer_wait(&pacer);                   // Sleep until just before this frame is due
+
+        // Follow the terminal size, unless the config fixes it or a recording keeps the size it was started with
+        if (terminal_resized && !dims.fixed_frame && rec == NULL) {
+            terminal_resized = 0;
+            int width, height;
+            if (read_terminal_size(&width, &height) && (width != X_PIXELS || height != Y_PIXELS)) {
+                free_picture(picture);
+                dims.x_pixels = width;
+                dims.y_pixels = height;
+                picture = init_picture();
+                printf("\033[2J");
+            }
+        }
+
         process_input();                      // Read user input (key states)
 
         if (is_key_pressed('q')) break;      // Quit if 'q' is pressed
 
         update_pos_view(&posview, blocks);    // Move/rotate player based on input
 
-        vect current_block = get_current_block(posview, blocks); // Block being looked at
-        int have_current_block = !ray_outside(current_block);
-        int current_block_x = (int)current_block.x;
-        int current_block_y = (int)current_block.y;
-        int current_block_z = (int)current_block.z;
-        char current_block_c = ' ';
-        int removed = 0;
-
-        if (have_current_block) {
-            // Check bounds before accessing
-            if (current_block_z >= 0 && current_block_z < Z_BLOCKS &&
-                current_block_y >= 0 && current_block_y < Y_BLOCKS &&
-                current_block_x >= 0 && current_block_x < X_BLOCKS) {
-                
-                current_block_c = blocks[current_block_z][current_block_y][current_block_x];
-
-                // Highlight the block being looked at with 'o'
-                blocks[current_block_z][current_block_y][current_block_x] = 'o';
-
-                // Remove block if 'x' is pressed
-                if (is_key_pressed('x')) {
-                    removed = 1;
-                    blocks[current_block_z][current_block_y][current_block_x] = ' ';
-                }
+        if (is_key_pressed('u')) region_undo(blocks, &journal);  // Undo the last edit
 
-                // Place a new block if space is pressed
-                if (is_key_pressed(' ')) {
-                    place_block(current_block, blocks, '@');
-                }
+        sim_tick(sim);                        // Let sand fall and water flow
+        scheduler_tick(ticks);                // Run the block updates that are due
+
+        // Follow the route, any movement key takes back control
+        if (is_key_pressed('i') || is_key_pressed('j') || is_key_pressed('k') || is_key_pressed('l')) {
+            route_at = walk.length;
+        }
+        if (route_at < walk.length) {
+            posview.pos.x = route[route_at].x + 0.5;
+            posview.pos.y = route[route_at].y + 0.5;
+            posview.pos.z = route[route_at].z + EYE_HEIGHT;
+            route_at++;
+        }
+
+        // Edits go to the block outlined on the last frame, the one the keys were pressed at,
+        // as long as nothing has changed it since
+        ray_hit current_block = selected;
+        int current_block_x = current_block.x;
+        int current_block_y = current_block.y;
+        int current_block_z = current_block.z;
+
+        if (current_block.hit && blocks[current_block_z][current_block_y][current_block_x] == current_block.block) {
+            // Remove block if 'x' is pressed
+            if (is_key_pressed('x')) {
+                region_fill(blocks, region_cell(current_block_x, current_block_y, current_block_z), ' ', &journal);
+            }
+
+            // Place a new block if space is pressed
+            if (is_key_pressed(' ')) {
+                place_block(current_block, blocks, '@', &journal);
+            }
+
+            // Walk to the top of the block with 'p'
+            if (is_key_pressed('p')) {
+                block_pos feet = { (int)posview.pos.x, (int)posview.pos.y, (int)(posview.pos.z - EYE_HEIGHT + 0.01) };
+                block_pos top = { current_block_x, current_block_y, current_block_z + 1 };
+                walk.start = feet;
+                walk.goal = top;
+                path_find_batch(paths, &walk, 1);
+                route_at = 1;
+            }
+
+            // Drop sand or water next to the block with 'n' and 'm'
+            if (is_key_pressed('n')) {
+                place_block(current_block, blocks, SAND, &journal);
+            }
+            if (is_key_pressed('m')) {
+                place_block(current_block, blocks, WATER, &journal);
+            }
+            if (is_key_pressed('g')) {
+                place_block(current_block, blocks, GLASS, &journal);
+            }
+            if (is_key_pressed('t')) {
+                place_block(current_block, blocks, SAPLING, &journal);
             }
         }
 
         // Perform ray tracing to generate the updated ASCII picture
         get_picture(picture, posview, blocks);
 
-        // Restore the original character of the block after rendering
-        if (have_current_block && !removed) {
-            if (current_block_z >= 0 && current_block_z < Z_BLOCKS &&
-                current_block_y >= 0 && current_block_y < Y_BLOCKS &&
-                current_block_x >= 0 && current_block_x < X_BLOCKS) {
-                blocks[current_block_z][current_block_y][current_block_x] = current_block_c;
-            }
+        // Outline the block looked at once this frame's edits are in, then the crosshair and status line
+        selected = get_current_block(posview, blocks);
+        if (selected.hit) {
+            const block_type* type = find_block_type(selected.block);
+            snprintf(status, sizeof(status), " %s at %d, %d, %d, %.1f away ", type != NULL ? type->name : "block",
+                selected.x, selected.y, selected.z, selected.distance);
+            draw_selection(picture, posview, selected.x, selected.y, selected.z);
+            draw_status(picture, status);
         }
+        draw_crosshair(picture);
 
+#ifdef TRACE_STATS
+        if (is_key_pressed('h')) show_heatmap = !show_heatmap;
+        if (show_heatmap) {
+            draw_heatmap();        // Render the traversal cost of each pixel
+        }
+        else {
+            draw_ascii(picture);   // Render the ASCII screen
+        }
+        trace_stats_log_frame();
+#else
         draw_ascii(picture);       // Render the ASCII screen
-        usleep(20000);             // Sleep for 20 ms to limit frame rate (~50 FPS)
-    }
+#endif
+        fflush(stdout);            // The frame is only on screen once it leaves stdio's buffer
+        latency_record(&latency, input_arrival_ns);
+        pacer_frame_done(&pacer);
+        if (wal != NULL) {
+            wal_maybe_checkpoint(wal, blocks);
+        }
 
-    // Free allocated memory
-    for (int i = 0; i < Y_PIXELS; i++) {
-        free(picture[i]);
-    }
-    free(picture);
-    
-    for (int i = 0; i < Z_BLOCKS; i++) {
-        for (int j = 0; j < Y_BLOCKS; j++) {
-            free(blocks[i][j]);
+        // Hand the finished frame to the recorder and continue in a recycled buffer
+        if (rec != NULL) {
+            picture = recorder_submit(rec, picture);
         }
-        free(blocks[i]);
     }
-    free(blocks);
 
     restore_terminal();           // Reset terminal on exit
+    if (report_latency) {
+        printf("\n");
+        latency_report(&latency, stdout);
+    }
+    if (rec != NULL) {
+        recorder_close(rec);
+    }
+    if (wal != NULL) {
+        wal_close(wal, blocks);
+    }
+
+    // Free allocated memory
+    free_picture(picture);
+
+#ifdef TRACE_STATS
+    if (stats.log != NULL) fclose(stats.log);
+    free(stats.steps);
+    free(stats.cells);
+#endif
+    free_path_service(paths);
+    free_scheduler(ticks);
+    free_sim(sim);
+    free_ao();
+    free_blocks(blocks);
+    journal_clear(&journal);
+    pool_shutdown();
     return 0;
 }
\ No newline at end of file